@@ -0,0 +1,374 @@
+/*
+Copyright (c) 2013, Sebastian Cato
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * farm --
+ *     a local target farm for the loopback benchmarks. Listens on every 
+ *     address and port of one or more address and port specs, with a 
+ *     behavior for each group:
+ *
+ *         accept       accept, and hold connections until the peer closes
+ *         refuse       bind without listening, so connections are refused
+ *         blackhole    listen without accepting, with a full backlog, so 
+ *                      SYNs are dropped and connections time out
+ *         banner=MS    accept, and send a banner line after MS milliseconds
+ *         large=BYTES  accept, and answer the first request, ended by an
+ *                      empty line, with a BYTES byte HTTP response header
+ *                      before closing
+ *         keepalive=BYTES
+ *                      accept, and answer every request, ended by an empty
+ *                      line, with an HTTP response header of BYTES bytes 
+ *                      times the number of requests on the connection so
+ *                      far. The connection is kept open
+ *
+ *     "ready <nsockets>" is written to stdout once everything listens. The
+ *     farm runs until it gets SIGINT or SIGTERM.
+ *
+ * example usage:
+ *     ./farm accept 127.2.0.0/24 20000-20003 refuse 127.3.0.0/30 20000
+ *     ./farm large=4096 127.2.0.0/28 8080 banner=50 127.2.1.0/28 22
+ *     ./farm keepalive=256 127.2.0.0/28 8080
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <event2/event.h>
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/listener.h>
+#include <yarlib/addr.h>
+#include <yarlib/port.h>
+
+#define BANNER          "SSH-2.0-farm\r\n"
+#define PADLINE_LEN     1000 /* longest header line of large responses */
+
+enum mode { 
+    M_ACCEPT, M_REFUSE, M_BLACKHOLE, M_BANNER, M_LARGE, M_KEEPALIVE 
+};
+
+struct group {
+    enum mode mode;
+    unsigned long arg;
+};
+
+struct conn {
+    const struct group *g;
+    struct bufferevent *bev;
+    struct event *timer;
+    unsigned long nreqs; /* requests answered, keepalive */
+};
+
+static struct event_base *_base;
+
+static void conn_free(struct conn *c)
+{
+    if (c->timer != NULL) {
+        event_free(c->timer);
+    }
+
+    bufferevent_free(c->bev);
+    free(c);
+}
+
+/* close once the response has been written */
+static void conn_on_drained(struct bufferevent *bev, void *arg)
+{
+    conn_free(arg);
+}
+
+/* write a response header of size bytes, or of the shortest possible 
+   size if it is less than that */
+static void respond(struct conn *c, size_t size)
+{
+    struct evbuffer *out = bufferevent_get_output(c->bev);
+    char pad[PADLINE_LEN];
+    size_t left, n;
+    int len;
+
+    len = evbuffer_add_printf(out, 
+            "HTTP/1.1 200 OK\r\nServer: farm\r\nContent-Length: 0\r\n");
+    left = size > (size_t)len + 2 ? size - (size_t)len - 2 : 0;
+    memset(pad, 'x', sizeof(pad));
+    while (left > 0) {
+        /* "X: " + value + CRLF, at least one byte of value */
+        n = left < sizeof(pad) ? left : sizeof(pad);
+        if (n < 6) {
+            n = 6;
+        }
+
+        evbuffer_add_printf(out, "X: %.*s\r\n", (int)(n - 5), pad);
+        left = left > n ? left - n : 0;
+    }
+
+    evbuffer_add(out, "\r\n", 2);
+}
+
+static void large_respond(struct conn *c)
+{
+    respond(c, c->g->arg);
+    bufferevent_disable(c->bev, EV_READ);
+    bufferevent_setcb(c->bev, NULL, conn_on_drained, NULL, c);
+}
+
+static void conn_on_read(struct bufferevent *bev, void *arg)
+{
+    struct conn *c = arg;
+    struct evbuffer *in = bufferevent_get_input(bev);
+    struct evbuffer_ptr p;
+
+    if (c->g->mode == M_LARGE) {
+        p = evbuffer_search(in, "\r\n\r\n", 4, NULL);
+        if (p.pos >= 0) {
+            large_respond(c);
+        }
+    } else if (c->g->mode == M_KEEPALIVE) {
+        while ((p = evbuffer_search(in, "\r\n\r\n", 4, NULL)).pos >= 0) {
+            evbuffer_drain(in, (size_t)p.pos + 4);
+            respond(c, c->g->arg * ++c->nreqs);
+        }
+    } else {
+        evbuffer_drain(in, evbuffer_get_length(in));
+    }
+}
+
+static void conn_on_event(struct bufferevent *bev, short what, void *arg)
+{
+    conn_free(arg);
+}
+
+static void conn_on_banner(evutil_socket_t fd, short what, void *arg)
+{
+    struct conn *c = arg;
+
+    bufferevent_write(c->bev, BANNER, sizeof(BANNER) - 1);
+}
+
+static void on_accept(struct evconnlistener *l, evutil_socket_t fd,
+        struct sockaddr *sa, int salen, void *arg)
+{
+    const struct group *g = arg;
+    struct timeval tv;
+    struct conn *c;
+
+    c = calloc(1, sizeof(*c));
+    if (c == NULL) {
+        close(fd);
+        return;
+    }
+
+    c->g = g;
+    c->bev = bufferevent_socket_new(_base, fd, BEV_OPT_CLOSE_ON_FREE);
+    if (c->bev == NULL) {
+        close(fd);
+        free(c);
+        return;
+    }
+
+    bufferevent_setcb(c->bev, conn_on_read, NULL, conn_on_event, c);
+    bufferevent_enable(c->bev, EV_READ);
+    if (g->mode == M_BANNER) {
+        c->timer = evtimer_new(_base, conn_on_banner, c);
+        if (c->timer == NULL) {
+            conn_free(c);
+            return;
+        }
+
+        tv.tv_sec = (time_t)(g->arg / 1000);
+        tv.tv_usec = (suseconds_t)(g->arg % 1000) * 1000;
+        evtimer_add(c->timer, &tv);
+    }
+}
+
+static int parse_mode(const char *s, struct group *g)
+{
+    static const struct {
+        const char *name;
+        enum mode mode;
+        int hasarg;
+    } modes[] = {
+        {"accept", M_ACCEPT, 0},
+        {"refuse", M_REFUSE, 0},
+        {"blackhole", M_BLACKHOLE, 0},
+        {"banner", M_BANNER, 1},
+        {"large", M_LARGE, 1},
+        {"keepalive", M_KEEPALIVE, 1},
+    };
+    const char *eq;
+    size_t i, len;
+
+    eq = strchr(s, '=');
+    len = eq != NULL ? (size_t)(eq - s) : strlen(s);
+    for (i = 0; i < sizeof(modes) / sizeof(*modes); i++) {
+        if (strlen(modes[i].name) == len && 
+                strncmp(modes[i].name, s, len) == 0 &&
+                (eq != NULL) == modes[i].hasarg) {
+            g->mode = modes[i].mode;
+            g->arg = eq != NULL ? strtoul(eq + 1, NULL, 10) : 0;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * add_socket --
+ *     bind a socket for a group. Blackhole sockets get a connection of 
+ *     their own, which fills the backlog
+ *
+ * @return -1 on error, 0 on success
+ */
+static int add_socket(const struct group *g, const yar_addr_t *addr, 
+        yar_port_t port)
+{
+    struct sockaddr_storage ss;
+    struct evconnlistener *l;
+    socklen_t sslen;
+    int fd, cfd, one = 1;
+
+    yar_addr_copy_to_storage(addr, (unsigned short)port, &ss, &sslen);
+    fd = socket(ss.ss_family, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+            bind(fd, (struct sockaddr *)&ss, sslen) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    switch (g->mode) {
+    case M_REFUSE:
+        return 0;
+    case M_BLACKHOLE:
+        cfd = socket(ss.ss_family, SOCK_STREAM, 0);
+        if (listen(fd, 0) < 0 || cfd < 0 || 
+                connect(cfd, (struct sockaddr *)&ss, sslen) < 0) {
+            close(fd);
+            return -1;
+        }
+
+        return 0;
+    default:
+        evutil_make_socket_nonblocking(fd);
+        l = evconnlistener_new(_base, on_accept, (void *)g, 
+                LEV_OPT_CLOSE_ON_FREE, 4096, fd);
+        if (l == NULL) {
+            close(fd);
+            return -1;
+        }
+
+        return 0;
+    }
+}
+
+static void on_signal(evutil_socket_t sig, short what, void *arg)
+{
+    event_base_loopexit(_base, NULL);
+}
+
+int main(int argc, char *argv[])
+{
+    struct group *groups;
+    struct rlimit rl;
+    struct event *sigs[2];
+    yar_addrspec_t *as;
+    yar_portspec_t *ps;
+    yar_addr_t addr;
+    yar_port_t port;
+    unsigned long nsockets = 0;
+    int i, ngroups;
+
+    if (argc < 4 || (argc - 1) % 3 != 0) {
+        fprintf(stderr, "usage: %s <mode> <addrspec> <portspec> ...\n"
+                "modes: accept refuse blackhole banner=<ms> "
+                "large=<bytes> keepalive=<bytes>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* one descriptor per listener, and per held connection */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    _base = event_base_new();
+    ngroups = (argc - 1) / 3;
+    groups = calloc((size_t)ngroups, sizeof(*groups));
+    if (_base == NULL || groups == NULL) {
+        perror("farm");
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < ngroups; i++) {
+        if (parse_mode(argv[1 + i * 3], &groups[i]) < 0) {
+            fprintf(stderr, "invalid mode: %s\n", argv[1 + i * 3]);
+            return EXIT_FAILURE;
+        }
+
+        as = yar_addrspec_new(argv[2 + i * 3]);
+        ps = yar_portspec_new(argv[3 + i * 3]);
+        if (as == NULL || ps == NULL) {
+            fprintf(stderr, "invalid addrspec or portspec: %s %s\n", 
+                    argv[2 + i * 3], argv[3 + i * 3]);
+            return EXIT_FAILURE;
+        }
+
+        while (yar_addrspec_next(as, &addr)) {
+            yar_portspec_reset(ps);
+            while (yar_portspec_next(ps, &port)) {
+                if (add_socket(&groups[i], &addr, port) < 0) {
+                    perror(argv[2 + i * 3]);
+                    return EXIT_FAILURE;
+                }
+
+                nsockets++;
+            }
+        }
+
+        yar_portspec_free(ps);
+        yar_addrspec_free(as);
+    }
+
+    sigs[0] = evsignal_new(_base, SIGINT, on_signal, NULL);
+    sigs[1] = evsignal_new(_base, SIGTERM, on_signal, NULL);
+    if (sigs[0] == NULL || sigs[1] == NULL || evsignal_add(sigs[0], NULL) < 0
+            || evsignal_add(sigs[1], NULL) < 0) {
+        perror("evsignal_new");
+        return EXIT_FAILURE;
+    }
+
+    printf("ready %lu\n", nsockets);
+    fflush(stdout);
+    event_base_dispatch(_base);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,421 @@
+/*
+Copyright (c) 2013, Sebastian Cato
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * iterators --
+ *     measures the address and port iteration primitives in ns per 
+ *     generated address, port or target, for realistic specs. addr.c and 
+ *     port.c are included to reach their static functions.
+ *
+ *     The results are printed as "<name> <ns>" lines, which is also the
+ *     format of the baseline in iterators.baseline. With -c, each result
+ *     is compared to a baseline, and the exit status is non-zero if any
+ *     is more than -t percent (default 10) slower.
+ *
+ * example usage:
+ *     ./iterators
+ *     ./iterators > iterators.baseline
+ *     ./iterators -c iterators.baseline -t 15
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../yarlib/addr.c"
+#include "../yarlib/port.c"
+
+#define NREPS           5       /* the median repetition is reported */
+#define NSTEPS          4000000 /* iterations of the primitives */
+#define MAX_RESULTS     64
+#define DEFAULT_THRESHOLD 10.0
+
+struct result {
+    const char *name;
+    double ns;
+};
+
+static volatile unsigned long _sink;
+
+static double now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static unsigned long addr_hash(const yar_addr_t *addr)
+{
+    const unsigned char *p = (const unsigned char *)&addr->saddr;
+
+    return (unsigned long)p[7] + p[23];
+}
+
+static char *alloc_spec(size_t len)
+{
+    char *spec;
+
+    if ((spec = malloc(len)) == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    return spec;
+}
+
+/* n /30 networks, one per /24 */
+static char *tiny_addrspec(unsigned int n)
+{
+    char *spec, *p;
+    unsigned int i;
+
+    p = spec = alloc_spec((size_t)n * 20 + 1);
+    for (i = 0; i < n; i++) {
+        p += sprintf(p, "%s10.%u.%u.0/30", i > 0 ? "," : "", i / 256, 
+                i % 256);
+    }
+
+    return spec;
+}
+
+/* n two-port ranges with gaps between them */
+static char *fragmented_portspec(unsigned int n)
+{
+    char *spec, *p;
+    unsigned int i;
+
+    p = spec = alloc_spec((size_t)n * 12 + 1);
+    for (i = 0; i < n; i++) {
+        p += sprintf(p, "%s%u-%u", i > 0 ? "," : "", 1 + i * 3, 2 + i * 3);
+    }
+
+    return spec;
+}
+
+static double bench_step(const char *addrstr, int dir)
+{
+    yar_addr_t addr;
+    double start;
+    unsigned int i;
+
+    yar_addr_init(&addr, addrstr);
+    start = now_ns();
+    for (i = 0; i < NSTEPS; i++) {
+        addr_step(&addr, dir);
+    }
+
+    _sink += addr_hash(&addr);
+    return (now_ns() - start) / NSTEPS;
+}
+
+/* step up and down alternately across the boundary between the low
+   32-bit words of addrstr and its successor, so every step carries */
+static double bench_step_carry(const char *addrstr)
+{
+    yar_addr_t addr;
+    double start;
+    unsigned int i;
+
+    yar_addr_init(&addr, addrstr);
+    start = now_ns();
+    for (i = 0; i < NSTEPS; i++) {
+        addr_step(&addr, (i & 1) ? ASTEP_DOWNWARD : ASTEP_UPWARD);
+    }
+
+    _sink += addr_hash(&addr);
+    return (now_ns() - start) / NSTEPS;
+}
+
+static double bench_step_towards(const char *from, const char *to)
+{
+    yar_addr_t addr, end;
+    double start;
+    unsigned int i;
+
+    yar_addr_init(&addr, from);
+    yar_addr_init(&end, to);
+    start = now_ns();
+    for (i = 0; i < NSTEPS && addr_step_towards(&addr, &end) > 0; i++)
+        ;
+
+    _sink += addr_hash(&addr);
+    return (now_ns() - start) / (i > 0 ? i : 1);
+}
+
+static double bench_mask(const char *addrstr, unsigned long mask)
+{
+    yar_addr_t addr;
+    double start;
+    unsigned int i;
+
+    yar_addr_init(&addr, addrstr);
+    start = now_ns();
+    for (i = 0; i < NSTEPS; i++) {
+        addr_clear_mask_bits(&addr, mask);
+        addr_set_mask_bits(&addr, mask);
+    }
+
+    _sink += addr_hash(&addr);
+    return (now_ns() - start) / (2.0 * NSTEPS);
+}
+
+/* ns per address of a whole addrspec */
+static double bench_addrspec(const char *specstr)
+{
+    yar_addrspec_t *spec;
+    yar_addr_t addr;
+    unsigned long n = 0;
+    double start;
+
+    if ((spec = yar_addrspec_new(specstr)) == NULL) {
+        fprintf(stderr, "invalid addrspec\n");
+        exit(EXIT_FAILURE);
+    }
+
+    start = now_ns();
+    while (yar_addrspec_next(spec, &addr)) {
+        _sink += addr_hash(&addr);
+        n++;
+    }
+
+    start = now_ns() - start;
+    yar_addrspec_free(spec);
+    return start / (double)(n > 0 ? n : 1);
+}
+
+/* ns per port of a portspec, iterated over and over */
+static double bench_portspec(const char *specstr)
+{
+    yar_portspec_t *spec;
+    yar_port_t port;
+    unsigned long n = 0;
+    double start;
+
+    if ((spec = yar_portspec_new(specstr)) == NULL) {
+        fprintf(stderr, "invalid portspec\n");
+        exit(EXIT_FAILURE);
+    }
+
+    start = now_ns();
+    while (n < NSTEPS) {
+        yar_portspec_reset(spec);
+        while (yar_portspec_next(spec, &port)) {
+            _sink += port;
+            n++;
+        }
+    }
+
+    start = now_ns() - start;
+    yar_portspec_free(spec);
+    return start / (double)n;
+}
+
+/* ns per target of an addrspec and a portspec, like yar_connect walks
+   them */
+static double bench_targets(const char *addrstr, const char *portstr)
+{
+    yar_addrspec_t *as;
+    yar_portspec_t *ps;
+    yar_addr_t addr;
+    yar_port_t port;
+    unsigned long n = 0;
+    double start;
+
+    as = yar_addrspec_new(addrstr);
+    ps = yar_portspec_new(portstr);
+    if (as == NULL || ps == NULL) {
+        fprintf(stderr, "invalid spec\n");
+        exit(EXIT_FAILURE);
+    }
+
+    start = now_ns();
+    while (yar_addrspec_next(as, &addr)) {
+        yar_portspec_reset(ps);
+        while (yar_portspec_next(ps, &port)) {
+            _sink += addr_hash(&addr) + port;
+            n++;
+        }
+    }
+
+    start = now_ns() - start;
+    yar_portspec_free(ps);
+    yar_addrspec_free(as);
+    return start / (double)(n > 0 ? n : 1);
+}
+
+static size_t run(struct result *res)
+{
+    static char *tiny, *frag;
+    size_t n = 0;
+    size_t i;
+    int rep, j;
+    double ns[MAX_RESULTS][NREPS], tmp;
+
+    if (tiny == NULL) {
+        /* 16384 /30s, and 2000 two-port ranges */
+        tiny = tiny_addrspec(16384);
+        frag = fragmented_portspec(2000);
+    }
+
+#define BENCH(_name, _expr) \
+    do { \
+        res[n].name = (_name); \
+        ns[n][rep] = (_expr); \
+        n++; \
+    } while (0)
+
+    for (rep = 0; rep < NREPS; rep++) {
+        n = 0;
+        BENCH("step_v4", bench_step("10.0.0.0", ASTEP_UPWARD));
+        BENCH("step_v4_down", bench_step("10.255.255.255", ASTEP_DOWNWARD));
+        BENCH("step_v6", bench_step("2001:db8::", ASTEP_UPWARD));
+        BENCH("step_v6_carry", bench_step_carry("2001:db8::ffff:ffff"));
+        BENCH("step_towards_v4", bench_step_towards("10.0.0.0", 
+                "10.255.255.255"));
+        BENCH("step_towards_v6", bench_step_towards("2001:db8::", 
+                "2001:db8::ffff:ffff"));
+        BENCH("mask_v4_8", bench_mask("10.1.2.3", 8));
+        BENCH("mask_v4_30", bench_mask("10.1.2.3", 30));
+        BENCH("mask_v6_64", bench_mask("2001:db8::1:2:3:4", 64));
+        BENCH("mask_v6_127", bench_mask("2001:db8::1:2:3:4", 127));
+        BENCH("addrspec_v4_cidr12", bench_addrspec("10.0.0.0/12"));
+        BENCH("addrspec_v4_tiny30", bench_addrspec(tiny));
+        BENCH("addrspec_v6_wordcross", 
+                bench_addrspec("2001:db8::ffff:fff0:0-2001:db8::1:0:10:0"));
+        BENCH("portspec_wide", bench_portspec("1-65535"));
+        BENCH("portspec_fragmented", bench_portspec(frag));
+        BENCH("targets_v4_24x1024", bench_targets("10.0.0.0/24", "1-1024"));
+        BENCH("targets_v4_16x4", 
+                bench_targets("10.0.0.0/16", "22,80,443,8080"));
+        BENCH("targets_v6_112xfrag", 
+                bench_targets("2001:db8::ffff:0/112", "22,80,443,8000-8010"));
+    }
+
+#undef BENCH
+
+    /* NREPS is small, an insertion sort per result will do */
+    for (i = 0; i < n; i++) {
+        for (rep = 1; rep < NREPS; rep++) {
+            tmp = ns[i][rep];
+            for (j = rep; j > 0 && ns[i][j-1] > tmp; j--) {
+                ns[i][j] = ns[i][j-1];
+            }
+
+            ns[i][j] = tmp;
+        }
+
+        res[i].ns = ns[i][NREPS / 2];
+    }
+
+    return n;
+}
+
+/**
+ * compare --
+ *     print each result next to its baseline
+ *
+ * @return the number of results more than threshold percent slower
+ */
+static int compare(const struct result *res, size_t n, const char *path,
+        double threshold)
+{
+    FILE *fp;
+    char line[256], name[128];
+    double base, delta;
+    size_t i;
+    int found, nslower = 0;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%-24s %10s %10s %8s\n", "name", "ns", "baseline", "delta");
+    for (i = 0; i < n; i++) {
+        found = 0;
+        rewind(fp);
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            if (line[0] != '#' && sscanf(line, "%127s %lf", name, &base) == 2
+                    && strcmp(name, res[i].name) == 0) {
+                found = 1;
+                break;
+            }
+        }
+
+        if (!found) {
+            printf("%-24s %10.2f %10s %8s\n", res[i].name, res[i].ns, "-", 
+                    "-");
+            continue;
+        }
+
+        delta = base > 0.0 ? 100.0 * (res[i].ns - base) / base : 0.0;
+        printf("%-24s %10.2f %10.2f %+7.1f%%%s\n", res[i].name, res[i].ns, 
+                base, delta, delta > threshold ? " SLOWER" : "");
+        if (delta > threshold) {
+            nslower++;
+        }
+    }
+
+    fclose(fp);
+    return nslower;
+}
+
+int main(int argc, char *argv[])
+{
+    struct result res[MAX_RESULTS];
+    const char *baseline = NULL;
+    double threshold = DEFAULT_THRESHOLD;
+    size_t i, n;
+    int ch;
+
+    while ((ch = getopt(argc, argv, "c:t:")) != -1) {
+        switch (ch) {
+        case 'c':
+            baseline = optarg;
+            break;
+        case 't':
+            threshold = strtod(optarg, NULL);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-c baseline] [-t percent]\n", 
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    n = run(res);
+    if (baseline != NULL) {
+        return compare(res, n, baseline, threshold) > 0 ? 
+                EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    for (i = 0; i < n; i++) {
+        printf("%s %.2f\n", res[i].name, res[i].ns);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,209 @@
+/*
+Copyright (c) 2013, Sebastian Cato
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * lifecycle --
+ *     measures the cost of the clocks that could timestamp endpoint events,
+ *     and the share of per-connection time that the timestamps yarlib 
+ *     records take, over connections to a local listener.
+ *
+ * example usage:
+ *     ./lifecycle
+ *     ./lifecycle 20000
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <event2/event.h>
+#include <yarlib/yar.h>
+
+#define NCALLS          10000000
+#define DEFAULT_NCONNS  10000
+#define NTIMESTAMPS     3 /* dispatch, connect and close for a connection 
+                             that is closed without reading */
+
+static volatile uint64_t _sink;
+static uint64_t _nconns, _connect_us;
+
+static double now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static double bench_clock(clockid_t id)
+{
+    struct timespec ts;
+    double start;
+    unsigned int i;
+
+    start = now_ns();
+    for (i = 0; i < NCALLS; i++) {
+        clock_gettime(id, &ts);
+        _sink += (uint64_t)ts.tv_nsec;
+    }
+
+    return (now_ns() - start) / NCALLS;
+}
+
+static double bench_gettimeofday()
+{
+    struct timeval tv;
+    double start;
+    unsigned int i;
+
+    start = now_ns();
+    for (i = 0; i < NCALLS; i++) {
+        gettimeofday(&tv, NULL);
+        _sink += (uint64_t)tv.tv_usec;
+    }
+
+    return (now_ns() - start) / NCALLS;
+}
+
+static double bench_cached()
+{
+    struct event_base *base;
+    struct timeval tv;
+    double start;
+    unsigned int i;
+
+    if ((base = event_base_new()) == NULL) {
+        return -1.0;
+    }
+
+    start = now_ns();
+    for (i = 0; i < NCALLS; i++) {
+        event_base_gettimeofday_cached(base, &tv);
+        _sink += (uint64_t)tv.tv_usec;
+    }
+
+    start = (now_ns() - start) / NCALLS;
+    event_base_free(base);
+    return start;
+}
+
+static void *acceptor(void *arg)
+{
+    int lfd = *(int *)arg, fd;
+
+    while ((fd = accept(lfd, NULL, NULL)) >= 0) {
+        close(fd);
+    }
+
+    return NULL;
+}
+
+static void on_established(struct yar_endpoint *ep)
+{
+    const struct yar_endpoint_times *t;
+
+    t = yar_endpoint_get_times(ep->handle);
+    _connect_us += t->connect - t->dispatch;
+    _nconns++;
+    yar_endpoint_terminate(ep);
+}
+
+static void on_error(struct yar_endpoint *ep)
+{
+}
+
+int main(int argc, char *argv[])
+{
+    struct yar_client cli;
+    struct sockaddr_in sin;
+    socklen_t len = sizeof(sin);
+    pthread_t thr;
+    char addrspec[64], portspec[16];
+    unsigned long n;
+    double mono, coarse, tod, cached, start, conn_ns;
+    int lfd;
+
+    n = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_NCONNS;
+    if (n == 0 || n > 65536) {
+        fprintf(stderr, "usage: %s [nconns (1-65536)]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    mono = bench_clock(CLOCK_MONOTONIC);
+    coarse = bench_clock(CLOCK_MONOTONIC_COARSE);
+    tod = bench_gettimeofday();
+    cached = bench_cached();
+    printf("%-32s %8s\n", "clock", "ns/call");
+    printf("%-32s %8.1f\n", "clock_gettime(MONOTONIC)", mono);
+    printf("%-32s %8.1f\n", "clock_gettime(MONOTONIC_COARSE)", coarse);
+    printf("%-32s %8.1f\n", "gettimeofday", tod);
+    printf("%-32s %8.1f\n", "event_base_gettimeofday_cached", cached);
+
+    /* every connection goes to its own loopback address */
+    lfd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (lfd < 0 || bind(lfd, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+            listen(lfd, 4096) < 0 || 
+            getsockname(lfd, (struct sockaddr *)&sin, &len) < 0 ||
+            pthread_create(&thr, NULL, acceptor, &lfd) != 0) {
+        perror("listener");
+        return EXIT_FAILURE;
+    }
+
+    snprintf(addrspec, sizeof(addrspec), "127.1.0.0-127.1.%lu.%lu", 
+            (n - 1) / 256, (n - 1) % 256);
+    snprintf(portspec, sizeof(portspec), "%u", ntohs(sin.sin_port));
+    memset(&cli, 0, sizeof(cli));
+    cli.proto = ADDRPROTO_TCP;
+    cli.ncc = 256;
+    cli.tr = 1000;
+    cli.to = 5000000;
+    cli.on_established = on_established;
+    cli.on_error = on_error;
+
+    start = now_ns();
+    if (yar_connect(&cli, addrspec, portspec) != 0) {
+        fprintf(stderr, "yar_connect failed\n");
+        return EXIT_FAILURE;
+    } 
+
+    yar_main();
+    conn_ns = (now_ns() - start) / (double)(_nconns > 0 ? _nconns : 1);
+    printf("\n%lu connections, %.0f conns/s, %.1f us/conn, "
+            "mean connect %.1f us\n", (unsigned long)_nconns, 
+            1e9 / conn_ns, conn_ns / 1000.0, 
+            _nconns > 0 ? (double)_connect_us / (double)_nconns : 0.0);
+    printf("%d timestamps/conn: %.1f ns, %.3f%% of the time per "
+            "connection\n", NTIMESTAMPS, NTIMESTAMPS * mono, 
+            100.0 * NTIMESTAMPS * mono / conn_ns);
+    return EXIT_SUCCESS;
+}
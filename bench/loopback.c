@@ -0,0 +1,398 @@
+/*
+Copyright (c) 2013, Sebastian Cato
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * loopback --
+ *     runs a tcp-connect or http-head style workload against a local 
+ *     target farm (see farm.c), which is started from the same directory
+ *     as this program, and writes the results as one JSON object per line
+ *     for regression tracking:
+ *
+ *         connect  connect and close. A quarter of the targets refuse, and
+ *                  a few are blackholed and time out
+ *         http     send a HEAD request, read a large response header
+ *         banner   read a banner line that is sent after a delay
+ *
+ *     Latencies are connect times for connect, and times to the first 
+ *     byte otherwise. Syscalls per probe count every syscall of the 
+ *     process, with the raw_syscalls:sys_enter tracepoint. That needs a 
+ *     mounted tracefs and a low enough perf_event_paranoid, or root; the
+ *     value is null otherwise. The read(2) and write(2) family calls 
+ *     counted in /proc/self/io are reported as well.
+ *     Each set of targets is a job of its own, and ncc is divided between
+ *     them by their number of targets. The reported ncc is the sum of 
+ *     their limits. RSS per connection is the growth of the peak RSS over 
+ *     the run, divided by that sum.
+ *
+ * example usage:
+ *     ./loopback
+ *     ./loopback http 16384 512
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <yarlib/yar.h>
+#include <yarlib/validators.h>
+
+#define DEFAULT_NTARGETS    4096
+#define DEFAULT_NCC         256
+#define NPORTS              64      /* ports per farm address */
+#define FIRST_PORT          20000
+#define NBLACKHOLED         4
+#define BLACKHOLE_CTO_US    250000
+#define TIMEOUT_US          5000000
+#define RESPONSE_LEN        4096
+#define BANNER_DELAY_MS     10
+#define NJOBS               3       /* accept, refuse and blackhole */
+
+static const char _req[] = "HEAD / HTTP/1.1\r\nHost: ${addrport}\r\n\r\n";
+static yar_tmpl_t *_tmpl;
+
+static double now_s()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* read(2) and write(2) family syscalls made by the process so far */
+static unsigned long long rw_syscalls()
+{
+    FILE *fp;
+    char line[128];
+    unsigned long long n = 0, v;
+
+    if ((fp = fopen("/proc/self/io", "r")) == NULL) {
+        return 0;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, "syscr: %llu", &v) == 1 || 
+                sscanf(line, "syscw: %llu", &v) == 1) {
+            n += v;
+        }
+    }
+
+    fclose(fp);
+    return n;
+}
+
+/**
+ * syscall_counter --
+ *     count every syscall the process makes, with the 
+ *     raw_syscalls:sys_enter tracepoint. The count is read with 
+ *     syscall_count
+ *
+ * @return a perf event descriptor, -1 on error
+ */
+static int syscall_counter()
+{
+    static const char *paths[] = {
+        "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+        "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id",
+    };
+    struct perf_event_attr attr;
+    unsigned long long id = 0;
+    size_t i;
+    FILE *fp;
+    int fd;
+
+    for (i = 0; i < sizeof(paths) / sizeof(*paths) && id == 0; i++) {
+        if ((fp = fopen(paths[i], "r")) != NULL) {
+            if (fscanf(fp, "%llu", &id) != 1) {
+                id = 0;
+            }
+
+            fclose(fp);
+        }
+    }
+
+    if (id == 0) {
+        return -1;
+    }
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_TRACEPOINT;
+    attr.size = sizeof(attr);
+    attr.config = id;
+    attr.disabled = 1;
+    fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (ioctl(fd, PERF_EVENT_IOC_RESET, 0) < 0 ||
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/* stop a syscall counter and return its count */
+static unsigned long long syscall_count(int fd)
+{
+    unsigned long long n;
+
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &n, sizeof(n)) != (ssize_t)sizeof(n)) {
+        n = 0;
+    }
+
+    close(fd);
+    return n;
+}
+
+static long maxrss_kb()
+{
+    struct rusage ru;
+
+    return getrusage(RUSAGE_SELF, &ru) == 0 ? ru.ru_maxrss : 0;
+}
+
+/**
+ * farm_start --
+ *     start the farm with the given arguments, and wait until it listens
+ *
+ * @return the pid of the farm, -1 on error
+ */
+static pid_t farm_start(const char *self, char *args[])
+{
+    char path[1024], line[64];
+    const char *slash;
+    int fds[2];
+    ssize_t n;
+    pid_t pid;
+
+    slash = strrchr(self, '/');
+    snprintf(path, sizeof(path), "%.*sfarm", 
+            slash != NULL ? (int)(slash - self + 1) : 0, self);
+    args[0] = path;
+    if (pipe(fds) < 0 || (pid = fork()) < 0) {
+        return -1;
+    } else if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execv(path, args);
+        perror(path);
+        _exit(EXIT_FAILURE);
+    }
+
+    close(fds[1]);
+    n = read(fds[0], line, sizeof(line) - 1);
+    close(fds[0]);
+    if (n <= 0 || strncmp(line, "ready", 5) != 0) {
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+
+    return pid;
+}
+
+static void on_connected(struct yar_endpoint *ep)
+{
+    yar_endpoint_terminate(ep);
+}
+
+static void on_established_http(struct yar_endpoint *ep)
+{
+    if (yar_endpoint_write_tmpl(ep->handle, _tmpl) != 0) {
+        yar_endpoint_terminate(ep);
+    }
+}
+
+static void on_read(struct yar_endpoint *ep)
+{
+    yar_endpoint_terminate(ep);
+}
+
+int main(int argc, char *argv[])
+{
+    struct yar_client cli[NJOBS];
+    struct yar_metrics m;
+    const yar_hist_t *lat;
+    const char *workload;
+    char accept_addrs[64], refuse_addrs[64], ports[32], mode[32];
+    char *args[12], syscalls[32];
+    unsigned long ntargets, ncc, naddrs, nrefuse, njobtargets[NJOBS], total;
+    unsigned int i, njobs;
+    unsigned long long sys0, nsys, nrw;
+    long rss0, rss;
+    struct rlimit rl;
+    double start, elapsed;
+    pid_t farm;
+    int sysfd;
+
+    workload = argc > 1 ? argv[1] : "connect";
+    ntargets = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_NTARGETS;
+    ncc = argc > 3 ? strtoul(argv[3], NULL, 10) : DEFAULT_NCC;
+    if ((strcmp(workload, "connect") != 0 && strcmp(workload, "http") != 0 &&
+            strcmp(workload, "banner") != 0) || ntargets < NPORTS ||
+            ntargets > NPORTS * 65536 || ncc == 0) {
+        fprintf(stderr, "usage: %s [connect|http|banner] [ntargets (>= %d)]"
+                " [ncc]\n", argv[0], NPORTS);
+        return EXIT_FAILURE;
+    }
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    /* NPORTS ports on each farm address. For connect, a quarter of the 
+       addresses refuse, and a few blackholed targets are added */
+    naddrs = ntargets / NPORTS;
+    nrefuse = strcmp(workload, "connect") == 0 ? naddrs / 4 : 0;
+    snprintf(accept_addrs, sizeof(accept_addrs), "127.2.0.0-127.2.%lu.%lu",
+            (naddrs - nrefuse - 1) / 256, (naddrs - nrefuse - 1) % 256);
+    snprintf(refuse_addrs, sizeof(refuse_addrs), "127.3.0.0-127.3.%lu.%lu",
+            nrefuse > 0 ? (nrefuse - 1) / 256 : 0, 
+            nrefuse > 0 ? (nrefuse - 1) % 256 : 0);
+    snprintf(ports, sizeof(ports), "%d-%d", FIRST_PORT, 
+            FIRST_PORT + NPORTS - 1);
+    if (strcmp(workload, "http") == 0) {
+        snprintf(mode, sizeof(mode), "large=%d", RESPONSE_LEN);
+    } else if (strcmp(workload, "banner") == 0) {
+        snprintf(mode, sizeof(mode), "banner=%d", BANNER_DELAY_MS);
+    } else {
+        snprintf(mode, sizeof(mode), "accept");
+    }
+
+    memset(args, 0, sizeof(args));
+    args[1] = mode;
+    args[2] = accept_addrs;
+    args[3] = ports;
+    if (nrefuse > 0) {
+        args[4] = "refuse";
+        args[5] = refuse_addrs;
+        args[6] = ports;
+        args[7] = "blackhole";
+        args[8] = "127.4.0.0";
+        args[9] = "20000-20003";
+    }
+
+    farm = farm_start(argv[0], args);
+    if (farm < 0) {
+        fprintf(stderr, "unable to start the farm\n");
+        return EXIT_FAILURE;
+    }
+
+    _tmpl = yar_tmpl_new(_req, sizeof(_req) - 1);
+    /* one job per set of targets, sharing ncc by their sizes */
+    njobs = nrefuse > 0 ? NJOBS : 1;
+    njobtargets[0] = (naddrs - nrefuse) * NPORTS;
+    njobtargets[1] = nrefuse * NPORTS;
+    njobtargets[2] = NBLACKHOLED;
+    for (total = 0, i = 0; i < njobs; i++) {
+        total += njobtargets[i];
+    }
+
+    memset(cli, 0, sizeof(cli));
+    for (i = 0; i < njobs; i++) {
+        cli[i].proto = ADDRPROTO_TCP;
+        cli[i].ncc = (unsigned int)(ncc * njobtargets[i] / total);
+        if (cli[i].ncc == 0) {
+            cli[i].ncc = 1;
+        }
+
+        cli[i].tr = 1000;
+        cli[i].to = TIMEOUT_US;
+        if (strcmp(workload, "connect") == 0) {
+            cli[i].on_established = on_connected;
+            cli[i].cto = BLACKHOLE_CTO_US;
+        } else {
+            cli[i].on_established = strcmp(workload, "http") == 0 ? 
+                    on_established_http : NULL;
+            cli[i].on_read = on_read;
+            cli[i].read_validator_inc = strcmp(workload, "http") == 0 ? 
+                    yar_rv_crlfcrlf_inc : yar_rv_line_inc;
+        }
+    }
+
+    for (ncc = 0, i = 0; i < njobs; i++) {
+        ncc += cli[i].ncc;
+    }
+
+    rss0 = maxrss_kb();
+    sys0 = rw_syscalls();
+    sysfd = syscall_counter();
+    start = now_s();
+    if (_tmpl == NULL || yar_connect(&cli[0], accept_addrs, ports) != 0 ||
+            (njobs > 1 && 
+            (yar_connect(&cli[1], refuse_addrs, ports) != 0 ||
+            yar_connect(&cli[2], "127.4.0.0", "20000-20003") != 0))) {
+        fprintf(stderr, "yar_connect failed\n");
+        kill(farm, SIGTERM);
+        waitpid(farm, NULL, 0);
+        return EXIT_FAILURE;
+    }
+
+    yar_main();
+    elapsed = now_s() - start;
+    nsys = sysfd >= 0 ? syscall_count(sysfd) : 0;
+    nrw = rw_syscalls() - sys0;
+    rss = maxrss_kb() - rss0;
+    kill(farm, SIGTERM);
+    waitpid(farm, NULL, 0);
+
+    yar_get_metrics(&m);
+    if (sysfd >= 0 && m.dispatched > 0) {
+        snprintf(syscalls, sizeof(syscalls), "%.2f", 
+                (double)nsys / (double)m.dispatched);
+    } else {
+        snprintf(syscalls, sizeof(syscalls), "null");
+    }
+
+    lat = strcmp(workload, "connect") == 0 ? &m.connect_us : &m.ttfb_us;
+    printf("{\"bench\":\"loopback\",\"workload\":\"%s\",\"targets\":%llu,"
+            "\"ncc\":%lu,\"elapsed_s\":%.3f,\"probes_per_s\":%.0f,"
+            "\"connects_per_s\":%.0f,\"established\":%llu,\"refused\":%llu,"
+            "\"timedout\":%llu,\"errors\":%llu,\"messages\":%llu,"
+            "\"p50_us\":%u,\"p99_us\":%u,\"syscalls_per_probe\":%s,"
+            "\"rw_syscalls_per_probe\":%.2f,\"rss_bytes_per_conn\":%.0f}\n",
+            workload, (unsigned long long)m.dispatched, ncc, elapsed,
+            (double)m.dispatched / elapsed, 
+            (double)m.established / elapsed,
+            (unsigned long long)m.established, 
+            (unsigned long long)m.refused, (unsigned long long)m.timedout, 
+            (unsigned long long)m.errors, (unsigned long long)m.messages,
+            yar_hist_percentile(lat, 50.0), yar_hist_percentile(lat, 99.0),
+            syscalls,
+            m.dispatched > 0 ? (double)nrw / (double)m.dispatched : 0.0,
+            (double)rss * 1024.0 / (double)ncc);
+    yar_tmpl_free(_tmpl);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,229 @@
+/*
+Copyright (c) 2013, Sebastian Cato
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * pool --
+ *     checks that connections kept by yar_endpoint_release carry nothing
+ *     of the previous message into the next job. Two jobs send a request
+ *     to every keepalive target of a local farm (see farm.c), which
+ *     answers the n:th request on a connection with n times RESPONSE_LEN
+ *     bytes. The first job frames its responses with an incremental
+ *     validator and releases the connections from on_read, the second job
+ *     reuses them with a validator that is not incremental. Exits with a
+ *     non-zero status unless every response of the first job is
+ *     RESPONSE_LEN bytes, and every response of the second job is
+ *     reported with the length of a second response.
+ *
+ * example usage:
+ *     ./pool
+ *     ./pool 4096
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <yarlib/yar.h>
+#include <yarlib/validators.h>
+
+#define DEFAULT_NTARGETS    256
+#define PORT                20000
+#define RESPONSE_LEN        512
+#define TIMEOUT_US          5000000
+
+struct job {
+    struct yar_client cli;
+    unsigned long nmsgs;    /* responses passed to on_read */
+    unsigned long nbad;     /* ... with an unexpected length */
+    unsigned long ndone;    /* endpoints done, for whatever reason */
+};
+
+static const char _req[] = "HEAD / HTTP/1.1\r\nHost: ${addrport}\r\n\r\n";
+static yar_tmpl_t *_tmpl;
+static struct job _jobs[2];
+static char _addrs[64], _ports[16];
+static unsigned long _ntargets;
+static struct job *_cur = &_jobs[0]; /* the jobs do not overlap */
+
+/**
+ * farm_start --
+ *     start the farm with the given arguments, and wait until it listens
+ *
+ * @return the pid of the farm, -1 on error
+ */
+static pid_t farm_start(const char *self, char *args[])
+{
+    char path[1024], line[64];
+    const char *slash;
+    int fds[2];
+    ssize_t n;
+    pid_t pid;
+
+    slash = strrchr(self, '/');
+    snprintf(path, sizeof(path), "%.*sfarm",
+            slash != NULL ? (int)(slash - self + 1) : 0, self);
+    args[0] = path;
+    if (pipe(fds) < 0 || (pid = fork()) < 0) {
+        return -1;
+    } else if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execv(path, args);
+        perror(path);
+        _exit(EXIT_FAILURE);
+    }
+
+    close(fds[1]);
+    n = read(fds[0], line, sizeof(line) - 1);
+    close(fds[0]);
+    if (n <= 0 || strncmp(line, "ready", 5) != 0) {
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+
+    return pid;
+}
+
+/* the second job is started once the first has released everything, so
+   that every one of its connections can come from the pool */
+static void job_done(struct job *j)
+{
+    if (++j->ndone == _ntargets && j == &_jobs[0]) {
+        _cur = &_jobs[1];
+        if (yar_connect(&_cur->cli, _addrs, _ports) != 0) {
+            fprintf(stderr, "yar_connect failed\n");
+        }
+    }
+}
+
+static void on_established(struct yar_endpoint *ep)
+{
+    if (yar_endpoint_write_tmpl(ep->handle, _tmpl) != 0) {
+        yar_endpoint_terminate(ep);
+    }
+}
+
+static void on_read(struct yar_endpoint *ep)
+{
+    struct job *j = _cur;
+    size_t len, expected;
+
+    /* the whole response is in the input, a reported length that is
+       shorter than the input is a stale one */
+    expected = j == &_jobs[0] ? RESPONSE_LEN : 2 * RESPONSE_LEN;
+    yar_endpoint_read(ep->handle, &len);
+    j->nmsgs++;
+    if (yar_endpoint_msglen(ep->handle) != expected || len != expected) {
+        j->nbad++;
+    }
+
+    /* connections with unread input are not kept */
+    yar_endpoint_consume(ep->handle, len);
+    job_done(j);
+    yar_endpoint_release(ep);
+}
+
+static void on_closed(struct yar_endpoint *ep)
+{
+    job_done(_cur);
+}
+
+int main(int argc, char *argv[])
+{
+    struct yar_metrics m;
+    struct rlimit rl;
+    char *args[5], mode[32];
+    unsigned int i;
+    pid_t farm;
+    int ok;
+
+    _ntargets = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_NTARGETS;
+    if (_ntargets == 0 || _ntargets > 65536) {
+        fprintf(stderr, "usage: %s [ntargets (1-65536)]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* the farm and the pool hold a descriptor per target */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    snprintf(_addrs, sizeof(_addrs), "127.5.0.0-127.5.%lu.%lu",
+            (_ntargets - 1) / 256, (_ntargets - 1) % 256);
+    snprintf(_ports, sizeof(_ports), "%d", PORT);
+    snprintf(mode, sizeof(mode), "keepalive=%d", RESPONSE_LEN);
+    args[1] = mode;
+    args[2] = _addrs;
+    args[3] = _ports;
+    args[4] = NULL;
+    farm = farm_start(argv[0], args);
+    if (farm < 0) {
+        fprintf(stderr, "unable to start the farm\n");
+        return EXIT_FAILURE;
+    }
+
+    _tmpl = yar_tmpl_new(_req, sizeof(_req) - 1);
+    memset(_jobs, 0, sizeof(_jobs));
+    for (i = 0; i < 2; i++) {
+        _jobs[i].cli.proto = ADDRPROTO_TCP;
+        _jobs[i].cli.ncc = 64;
+        _jobs[i].cli.tr = 1000;
+        _jobs[i].cli.to = TIMEOUT_US;
+        _jobs[i].cli.npool = (unsigned int)_ntargets;
+        _jobs[i].cli.on_established = on_established;
+        _jobs[i].cli.on_read = on_read;
+        _jobs[i].cli.on_eof = on_closed;
+        _jobs[i].cli.on_timeout = on_closed;
+        _jobs[i].cli.on_error = on_closed;
+    }
+
+    _jobs[0].cli.read_validator_inc = yar_rv_crlfcrlf_inc;
+    _jobs[1].cli.read_validator = yar_rv_crlfcrlf;
+    if (_tmpl == NULL || yar_connect(&_jobs[0].cli, _addrs, _ports) != 0) {
+        fprintf(stderr, "yar_connect failed\n");
+        kill(farm, SIGTERM);
+        waitpid(farm, NULL, 0);
+        return EXIT_FAILURE;
+    }
+
+    yar_main();
+    kill(farm, SIGTERM);
+    waitpid(farm, NULL, 0);
+
+    yar_get_metrics(&m);
+    ok = _jobs[0].nmsgs == _ntargets && _jobs[1].nmsgs == _ntargets &&
+            _jobs[0].nbad == 0 && _jobs[1].nbad == 0;
+    printf("{\"bench\":\"pool\",\"targets\":%lu,\"response_len\":%d,"
+            "\"first_msgs\":%lu,\"first_bad\":%lu,\"second_msgs\":%lu,"
+            "\"second_bad\":%lu,\"dispatched\":%llu,\"ok\":%s}\n",
+            _ntargets, RESPONSE_LEN, _jobs[0].nmsgs, _jobs[0].nbad,
+            _jobs[1].nmsgs, _jobs[1].nbad,
+            (unsigned long long)m.dispatched, ok ? "true" : "false");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,123 @@
+/*
+Copyright (c) 2013, Sebastian Cato
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * schedrate --
+ *     checks that the global scheduler (see yar_set_limits) keeps the rate
+ *     limits of jobs that tick slower than it does. A slow job is run on a
+ *     simulated network (see yarlib/sim.h), first on its own and then 
+ *     with global limits that are too high to matter, and the two rates 
+ *     are compared. Exits with a non-zero status if they differ by more 
+ *     than a few percent.
+ *
+ * example usage:
+ *     ./schedrate
+ *     ./schedrate 4096 2 20
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <yarlib/yar.h>
+
+#define DEFAULT_NTARGETS    1024
+#define DEFAULT_TR          1
+#define DEFAULT_CPT         10
+#define TOLERANCE           0.05
+#define GLOBAL_CPS          1000000
+
+static void on_established(struct yar_endpoint *ep)
+{
+    yar_endpoint_terminate(ep);
+}
+
+/* the rate of a job in connections per virtual second, < 0 on error */
+static double run(unsigned long ntargets, unsigned int tr, unsigned int cpt, 
+        int limited)
+{
+    struct yar_sim_params params;
+    struct yar_job_summary sum;
+    struct yar_client cli;
+    char addrs[64];
+    yar_sim_t *sim;
+    double rate = -1.0;
+
+    memset(&params, 0, sizeof(params));
+    params.seed = 1;
+    params.rtt_min = 1000;
+    params.rtt_max = 50000;
+    sim = yar_sim_new(&params);
+    if (sim == NULL || yar_set_sim(sim) != 0) {
+        yar_sim_free(sim);
+        return -1.0;
+    }
+
+    yar_set_limits(0, limited ? GLOBAL_CPS : 0);
+    snprintf(addrs, sizeof(addrs), "10.0.0.0-10.%lu.%lu.%lu", 
+            (ntargets - 1) >> 16, ((ntargets - 1) >> 8) & 0xff, 
+            (ntargets - 1) & 0xff);
+    memset(&cli, 0, sizeof(cli));
+    memset(&sum, 0, sizeof(sum));
+    cli.proto = ADDRPROTO_TCP;
+    cli.tr = tr;
+    cli.cpt = cpt;
+    cli.to = 1000000;
+    cli.on_established = on_established;
+    cli.summary = &sum;
+    if (yar_connect(&cli, addrs, "80") == 0) {
+        yar_main();
+        if (sum.elapsed_us > 0) {
+            rate = (double)sum.dispatched * 1e6 / (double)sum.elapsed_us;
+        }
+    }
+
+    yar_set_limits(0, 0);
+    yar_set_sim(NULL);
+    yar_sim_free(sim);
+    return rate;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long ntargets, tr, cpt;
+    double alone, limited;
+    int ok;
+
+    ntargets = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_NTARGETS;
+    tr = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_TR;
+    cpt = argc > 3 ? strtoul(argv[3], NULL, 10) : DEFAULT_CPT;
+    if (ntargets == 0 || ntargets > (1UL << 24) || tr == 0 || cpt == 0) {
+        fprintf(stderr, "usage: %s [ntargets] [tr] [cpt]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    alone = run(ntargets, (unsigned int)tr, (unsigned int)cpt, 0);
+    limited = run(ntargets, (unsigned int)tr, (unsigned int)cpt, 1);
+    ok = alone > 0 && limited > 0 && limited <= alone * (1.0 + TOLERANCE) &&
+            limited >= alone * (1.0 - TOLERANCE);
+    printf("{\"bench\":\"schedrate\",\"targets\":%lu,\"tr\":%lu,\"cpt\":%lu,"
+            "\"alone_per_s\":%.2f,\"limited_per_s\":%.2f,\"ok\":%s}\n",
+            ntargets, tr, cpt, alone, limited, ok ? "true" : "false");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
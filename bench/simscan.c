@@ -0,0 +1,197 @@
+/*
+Copyright (c) 2013, Sebastian Cato
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * simscan --
+ *     runs a scan against a simulated network (see yarlib/sim.h) in 
+ *     virtual time, and writes the results as one JSON object per line. 
+ *     Targets are consecutive addresses from 10.0.0.0, on one port. 
+ *     Nothing is connected to, so the scan is limited only by the 
+ *     scheduler, not by file descriptors or the network:
+ *
+ *         connect  connect and close
+ *         http     send a HEAD request, read the response header
+ *         banner   read a banner that is sent on connect
+ *
+ *     A share of the targets refuse or drop connections, and a few have
+ *     a long RTT. Rates are per virtual second and per wall clock 
+ *     second. Latencies are in virtual time, and are connect times for 
+ *     connect and times to the first byte otherwise.
+ *
+ * example usage:
+ *     ./simscan
+ *     ./simscan http 10000000 50000 100
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <yarlib/yar.h>
+#include <yarlib/validators.h>
+
+#define DEFAULT_NTARGETS    1000000
+#define DEFAULT_NCC         10000
+#define DEFAULT_TR          100
+#define MAX_NTARGETS        (1UL << 24)
+#define SEED                1
+#define CTO_US              2000000
+#define TIMEOUT_US          5000000
+
+static const char _req[] = "HEAD / HTTP/1.1\r\nHost: ${addrport}\r\n\r\n";
+static yar_tmpl_t *_tmpl;
+
+static double now_s()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static long maxrss_kb()
+{
+    struct rusage ru;
+
+    return getrusage(RUSAGE_SELF, &ru) == 0 ? ru.ru_maxrss : 0;
+}
+
+static void on_connected(struct yar_endpoint *ep)
+{
+    yar_endpoint_terminate(ep);
+}
+
+static void on_established_http(struct yar_endpoint *ep)
+{
+    if (yar_endpoint_write_tmpl(ep->handle, _tmpl) != 0) {
+        yar_endpoint_terminate(ep);
+    }
+}
+
+static void on_read(struct yar_endpoint *ep)
+{
+    yar_endpoint_terminate(ep);
+}
+
+int main(int argc, char *argv[])
+{
+    struct yar_sim_params params;
+    struct yar_job_summary sum;
+    struct yar_client cli;
+    struct yar_metrics m;
+    const yar_hist_t *lat;
+    const char *workload;
+    char addrs[64];
+    unsigned long ntargets, ncc, tr;
+    yar_sim_t *sim;
+    double start, elapsed, vsecs;
+
+    workload = argc > 1 ? argv[1] : "connect";
+    ntargets = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_NTARGETS;
+    ncc = argc > 3 ? strtoul(argv[3], NULL, 10) : DEFAULT_NCC;
+    tr = argc > 4 ? strtoul(argv[4], NULL, 10) : DEFAULT_TR;
+    if ((strcmp(workload, "connect") != 0 && strcmp(workload, "http") != 0 &&
+            strcmp(workload, "banner") != 0) || ntargets == 0 ||
+            ntargets > MAX_NTARGETS || ncc == 0 || tr == 0) {
+        fprintf(stderr, "usage: %s [connect|http|banner] [ntargets (<= %lu)]"
+                " [ncc] [tr]\n", argv[0], MAX_NTARGETS);
+        return EXIT_FAILURE;
+    }
+
+    memset(&params, 0, sizeof(params));
+    params.seed = SEED;
+    params.rtt_min = 10000;
+    params.rtt_max = 200000;
+    params.tail_ppm = 10000;
+    params.tail_factor = 5;
+    params.refuse_ppm = 200000;
+    params.loss_ppm = 50000;
+    if (strcmp(workload, "connect") != 0) {
+        params.resp_min = 128;
+        params.resp_max = 1024;
+    }
+
+    if (strcmp(workload, "banner") == 0) {
+        params.flags = SIM_FLG_BANNER;
+    }
+
+    sim = yar_sim_new(&params);
+    if (sim == NULL || yar_set_sim(sim) != 0) {
+        fprintf(stderr, "unable to set up the simulation\n");
+        return EXIT_FAILURE;
+    }
+
+    snprintf(addrs, sizeof(addrs), "10.0.0.0-10.%lu.%lu.%lu", 
+            (ntargets - 1) >> 16, ((ntargets - 1) >> 8) & 0xff, 
+            (ntargets - 1) & 0xff);
+    _tmpl = yar_tmpl_new(_req, sizeof(_req) - 1);
+    memset(&cli, 0, sizeof(cli));
+    memset(&sum, 0, sizeof(sum));
+    cli.proto = ADDRPROTO_TCP;
+    cli.ncc = (unsigned int)ncc;
+    cli.tr = (unsigned int)tr;
+    cli.to = TIMEOUT_US;
+    cli.cto = CTO_US;
+    cli.summary = &sum;
+    if (strcmp(workload, "connect") == 0) {
+        cli.on_established = on_connected;
+    } else {
+        cli.on_established = strcmp(workload, "http") == 0 ? 
+                on_established_http : NULL;
+        cli.on_read = on_read;
+        cli.read_validator_inc = yar_rv_crlfcrlf_inc;
+    }
+
+    start = now_s();
+    if (_tmpl == NULL || yar_connect(&cli, addrs, "80") != 0) {
+        fprintf(stderr, "yar_connect failed\n");
+        return EXIT_FAILURE;
+    }
+
+    yar_main();
+    elapsed = now_s() - start;
+    vsecs = (double)sum.elapsed_us / 1e6;
+
+    yar_get_metrics(&m);
+    lat = strcmp(workload, "connect") == 0 ? &m.connect_us : &m.ttfb_us;
+    printf("{\"bench\":\"simscan\",\"workload\":\"%s\",\"targets\":%llu,"
+            "\"ncc\":%lu,\"tr\":%lu,\"virtual_s\":%.3f,\"elapsed_s\":%.3f,"
+            "\"probes_per_vs\":%.0f,\"probes_per_s\":%.0f,"
+            "\"established\":%llu,\"refused\":%llu,\"timedout\":%llu,"
+            "\"errors\":%llu,\"messages\":%llu,\"p50_us\":%u,\"p99_us\":%u,"
+            "\"maxrss_kb\":%ld}\n",
+            workload, (unsigned long long)m.dispatched, ncc, tr, vsecs, 
+            elapsed, vsecs > 0 ? (double)m.dispatched / vsecs : 0.0,
+            (double)m.dispatched / elapsed,
+            (unsigned long long)m.established, 
+            (unsigned long long)m.refused, (unsigned long long)m.timedout, 
+            (unsigned long long)m.errors, (unsigned long long)m.messages,
+            yar_hist_percentile(lat, 50.0), yar_hist_percentile(lat, 99.0),
+            maxrss_kb());
+    yar_tmpl_free(_tmpl);
+    yar_set_sim(NULL);
+    yar_sim_free(sim);
+    return EXIT_SUCCESS;
+}
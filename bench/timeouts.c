@@ -0,0 +1,173 @@
+/*
+Copyright (c) 2013, Sebastian Cato
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * timeouts --
+ *     measures the event loop cost of per-connection timeouts as the number
+ *     of concurrent connections grows, comparing libevent's min-heap
+ *     timeouts with common timeout queues (which is what yarlib uses).
+ *
+ * example usage:
+ *     ./timeouts
+ *     ./timeouts 1000 50000
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <event2/event.h>
+
+#define TIMEOUT_US      2000000
+#define NLOOPS          1000
+
+static const unsigned int default_sizes[] = {
+    1000, 10000, 50000, 100000, 200000, 500000
+};
+
+struct result {
+    double arm_ns;      /* ns per initial event_add */
+    double rearm_ns;    /* ns per event_add on a pending event */
+    double loop_ns;     /* ns per non-blocking loop iteration */
+    double cancel_ns;   /* ns per event_del */
+};
+
+static double now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void on_timeout(evutil_socket_t fd, short what, void *data)
+{
+}
+
+static int run(unsigned int n, int common, struct result *r)
+{
+    struct event_base *base;
+    struct event **evs;
+    const struct timeval *tvp;
+    struct timeval tv;
+    unsigned int i, *order;
+    double start;
+
+    base = event_base_new();
+    if (base == NULL) {
+        return -1;
+    }
+
+    evs = calloc(n, sizeof(*evs));
+    order = calloc(n, sizeof(*order));
+    if (evs == NULL || order == NULL) {
+        free(evs);
+        free(order);
+        event_base_free(base);
+        return -1;
+    }
+
+    tv.tv_sec = TIMEOUT_US / 1000000;
+    tv.tv_usec = TIMEOUT_US % 1000000;
+    tvp = common ? event_base_init_common_timeout(base, &tv) : &tv;
+    for (i = 0; i < n; i++) {
+        evs[i] = evtimer_new(base, on_timeout, NULL);
+        order[i] = i;
+    }
+
+    /* connections see activity in no particular order */
+    srand(n);
+    for (i = n - 1; i > 0; i--) {
+        unsigned int j = (unsigned int)rand() % (i + 1), tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+
+    start = now_ns();
+    for (i = 0; i < n; i++) {
+        evtimer_add(evs[i], tvp);
+    }
+    r->arm_ns = (now_ns() - start) / n;
+
+    event_base_loop(base, EVLOOP_NONBLOCK);
+    start = now_ns();
+    for (i = 0; i < n; i++) {
+        evtimer_add(evs[order[i]], tvp);
+    }
+    r->rearm_ns = (now_ns() - start) / n;
+
+    start = now_ns();
+    for (i = 0; i < NLOOPS; i++) {
+        event_base_loop(base, EVLOOP_NONBLOCK);
+    }
+    r->loop_ns = (now_ns() - start) / NLOOPS;
+
+    start = now_ns();
+    for (i = 0; i < n; i++) {
+        evtimer_del(evs[order[i]]);
+    }
+    r->cancel_ns = (now_ns() - start) / n;
+
+    for (i = 0; i < n; i++) {
+        event_free(evs[i]);
+    }
+
+    free(order);
+    free(evs);
+    event_base_free(base);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct result heap, common;
+    unsigned int n;
+    size_t i, nsizes;
+
+    nsizes = argc > 1 ? (size_t)argc - 1 : 
+            sizeof(default_sizes) / sizeof(*default_sizes);
+    printf("%-8s %-7s %10s %10s %10s %10s\n", "conns", "queue", "arm_ns",
+            "rearm_ns", "loop_ns", "cancel_ns");
+    for (i = 0; i < nsizes; i++) {
+        n = argc > 1 ? (unsigned int)strtoul(argv[i+1], NULL, 10) : 
+                default_sizes[i];
+        if (n == 0) {
+            fprintf(stderr, "invalid size: %s\n", argv[i+1]);
+            return EXIT_FAILURE;
+        }
+
+        if (run(n, 0, &heap) < 0 || run(n, 1, &common) < 0) {
+            fprintf(stderr, "benchmark failed for %u connections\n", n);
+            return EXIT_FAILURE;
+        }
+
+        printf("%-8u %-7s %10.1f %10.1f %10.1f %10.1f\n", n, "heap", 
+                heap.arm_ns, heap.rearm_ns, heap.loop_ns, heap.cancel_ns);
+        printf("%-8u %-7s %10.1f %10.1f %10.1f %10.1f\n", n, "common", 
+                common.arm_ns, common.rearm_ns, common.loop_ns, 
+                common.cancel_ns);
+    }
+
+    return EXIT_SUCCESS;
+}
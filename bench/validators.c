@@ -0,0 +1,234 @@
+/*
+Copyright (c) 2013, Sebastian Cato
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * validators --
+ *     measures the throughput of the framing validators in validators.h
+ *     at each SIMD level, against naive byte-at-a-time scanning and libc.
+ *     Messages are fed to the incremental validators in segments, like
+ *     the chains of an evbuffer.
+ *
+ * example usage:
+ *     ./validators
+ *     ./validators 512 65536
+ */
+#define _GNU_SOURCE /* memmem(3) */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <yarlib/validators.h>
+
+#define SEGMENT_SIZE    4096
+#define BYTES_PER_RUN   (256UL * 1024 * 1024)
+
+static const size_t default_sizes[] = {
+    256, 4096, 65536, 1048576
+};
+
+typedef int (*validate_func)(const unsigned char *data, size_t len);
+
+static double now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* what http-head used to do */
+static int naive_crlfcrlf(const unsigned char *data, size_t len)
+{
+    static const char term[] = "\r\n\r\n";
+    size_t i, state = 0;
+
+    for (i = 0; i < len; i++) {
+        if (data[i] == term[state]) {
+            if (++state == sizeof(term) - 1) {
+                return RVALIDATOR_OK;
+            }
+        } else {
+            state = (data[i] == term[0]) ? 1 : 0;
+        }
+    }
+
+    return RVALIDATOR_INCOMPLETE;
+}
+
+static int memmem_crlfcrlf(const unsigned char *data, size_t len)
+{
+    return memmem(data, len, "\r\n\r\n", 4) != NULL ? 
+            RVALIDATOR_OK : RVALIDATOR_INCOMPLETE;
+}
+
+static int naive_line(const unsigned char *data, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (data[i] == '\n') {
+            return RVALIDATOR_OK;
+        }
+    }
+
+    return RVALIDATOR_INCOMPLETE;
+}
+
+static int memchr_line(const unsigned char *data, size_t len)
+{
+    return memchr(data, '\n', len) != NULL ? 
+            RVALIDATOR_OK : RVALIDATOR_INCOMPLETE;
+}
+
+static int segmented(yar_read_validator_inc validator, 
+        const unsigned char *data, size_t len)
+{
+    struct yar_rvstate st;
+    size_t n;
+    int ret = RVALIDATOR_INCOMPLETE;
+
+    memset(&st, 0, sizeof(st));
+    while (st.off < len) {
+        n = len - st.off < SEGMENT_SIZE ? len - st.off : SEGMENT_SIZE;
+        ret = validator(&st, data + st.off, n);
+        if (ret != RVALIDATOR_INCOMPLETE) {
+            break;
+        }
+
+        st.off += n;
+    }
+
+    return ret;
+}
+
+static int rv_crlfcrlf(const unsigned char *data, size_t len)
+{
+    return segmented(yar_rv_crlfcrlf_inc, data, len);
+}
+
+static int rv_line(const unsigned char *data, size_t len)
+{
+    return segmented(yar_rv_line_inc, data, len);
+}
+
+/* header lines, or one long line, with the delimiter at the very end */
+static unsigned char *make_message(size_t len, int header)
+{
+    static const char line[] = "X-Header-Field: some value of a header\r\n";
+    unsigned char *data;
+    size_t i;
+
+    data = malloc(len);
+    if (data == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < len; i++) {
+        data[i] = header ? line[i % (sizeof(line) - 1)] : 'a' + i % 26;
+    }
+
+    if (header) {
+        memcpy(data + len - 4, "\r\n\r\n", 4);
+    } else {
+        data[len - 1] = '\n';
+    }
+
+    return data;
+}
+
+/* MB/s, or a negative value if the function does not find the end */
+static double measure(validate_func func, const unsigned char *data,
+        size_t len)
+{
+    size_t i, n;
+    double start;
+
+    n = BYTES_PER_RUN / len + 1;
+    for (i = 0; i < n / 16; i++) {
+        func(data, len); /* warm up */
+    }
+
+    start = now_ns();
+    for (i = 0; i < n; i++) {
+        if (func(data, len) != RVALIDATOR_OK) {
+            return -1.0;
+        }
+    }
+
+    return (double)(n * len) / ((now_ns() - start) / 1e9) / 1e6;
+}
+
+static void run(const char *name, validate_func naive, validate_func libc, 
+        validate_func rv, const unsigned char *data, size_t len)
+{
+    static const int levels[] = {RV_SIMD_SCALAR, RV_SIMD_SSE2, RV_SIMD_AVX2};
+    size_t i;
+
+    printf("%-9s %8zu %10.0f %10.0f", name, len, measure(naive, data, len),
+            measure(libc, data, len));
+    for (i = 0; i < sizeof(levels) / sizeof(*levels); i++) {
+        if (yar_rv_set_simd(levels[i]) == levels[i]) {
+            printf(" %10.0f", measure(rv, data, len));
+        } else {
+            printf(" %10s", "-");
+        }
+    }
+
+    printf("\n");
+    yar_rv_set_simd(RV_SIMD_AUTO);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned char *hdr, *line;
+    size_t i, nsizes, len;
+
+    nsizes = argc > 1 ? (size_t)argc - 1 : 
+            sizeof(default_sizes) / sizeof(*default_sizes);
+    printf("%-9s %8s %10s %10s %10s %10s %10s   (MB/s)\n", "framing", 
+            "msglen", "naive", "libc", "scalar", "sse2", "avx2");
+    for (i = 0; i < nsizes; i++) {
+        len = argc > 1 ? strtoul(argv[i+1], NULL, 10) : default_sizes[i];
+        if (len < 4) {
+            fprintf(stderr, "invalid size: %s\n", argv[i+1]);
+            return EXIT_FAILURE;
+        }
+
+        hdr = make_message(len, 1);
+        line = make_message(len, 0);
+        if (hdr == NULL || line == NULL) {
+            fprintf(stderr, "malloc failed\n");
+            return EXIT_FAILURE;
+        }
+
+        run("crlfcrlf", naive_crlfcrlf, memmem_crlfcrlf, rv_crlfcrlf, hdr, 
+                len);
+        run("line", naive_line, memchr_line, rv_line, line, len);
+        free(hdr);
+        free(line);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -25,22 +25,24 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <yarlib/yar.h>
+#include <yarlib/validators.h>
 
 #define NCURRCONNS      500
 #define TICKRATE        10
 #define IO_TIMEOUT_US   2000000
 
+static const char _req[] = "HEAD / HTTP/1.1\r\nHost: ${addrport}\r\n\r\n";
+
+static yar_sink_t *_out;
+static yar_tmpl_t *_tmpl;
+
 static void on_established(struct yar_endpoint *ep)
 {
-    static const char req[] = "HEAD / HTTP/1.1\r\nHost: %s\r\n\r\n";
-    char sendbuf[512], hoststr[64];
-
-    yar_addr_to_addrport_str(&ep->addr, (unsigned short)ep->port, hoststr,
-            sizeof(hoststr));
-    snprintf(sendbuf, sizeof(sendbuf), req, hoststr);
-    sendbuf[sizeof(sendbuf)-1] = '\0';
-    yar_endpoint_write(ep->handle, sendbuf, strlen(sendbuf));  
+    if (yar_endpoint_write_tmpl(ep->handle, _tmpl) != 0) {
+        yar_endpoint_terminate(ep);
+    }
 }
 
 static void on_read(struct yar_endpoint *ep)
@@ -52,33 +54,82 @@ static void on_read(struct yar_endpoint *ep)
     if (read != NULL) {
         yar_addr_to_str(&ep->addr, addrbuf);
         yar_port_to_str(ep->port, portbuf, sizeof(portbuf));
-        printf("%s %s\n%.*s\n%%%%\n\n", addrbuf, portbuf, (int)len, read);
+        len = yar_endpoint_msglen(ep->handle);
+        yar_sink_printf(_out, "%s %s\n%.*s\n%%%%\n\n", addrbuf, portbuf, 
+                (int)len, read);
         yar_endpoint_terminate(ep);
     }
 
 }
 
-static int read_validator(const void *data, size_t len)
+/* print the IDs of the matched patterns instead of the header */
+static void on_read_classify(struct yar_endpoint *ep)
 {
-    return strstr(data, "\r\n\r\n") == NULL ? RVALIDATOR_INCOMPLETE :
-            RVALIDATOR_OK;
+    const unsigned int *ids;
+    size_t i, nids;
+    char line[1024], addrbuf[ADDR_STRLEN], portbuf[16];
+    int len;
+
+    yar_addr_to_str(&ep->addr, addrbuf);
+    yar_port_to_str(ep->port, portbuf, sizeof(portbuf));
+    len = snprintf(line, sizeof(line), "%s %s", addrbuf, portbuf);
+    nids = yar_endpoint_matches(ep->handle, &ids);
+    for (i = 0; i < nids && len < (int)sizeof(line); i++) {
+        len += snprintf(line + len, sizeof(line) - (size_t)len, "%c%u", 
+                i == 0 ? ' ' : ',', ids[i]);
+    }
+
+    if (len < (int)sizeof(line)) {
+        yar_sink_printf(_out, "%s%s\n", line, nids == 0 ? " -" : "");
+    }
+
+    yar_endpoint_terminate(ep);
 }
 
 int main(int argc, char *argv[])
 {
     struct yar_client cli;
+    yar_matcher_t *matcher = NULL;
     int retval = EXIT_FAILURE;
 
-    if (argc != 3) {
-        fprintf(stderr, "usage: %s <addrspec> <portspec>\n", argv[0]);
+    if (argc != 3 && argc != 4) {
+        fprintf(stderr, "usage: %s <addrspec> <portspec> [patternfile]\n", 
+                argv[0]);
         return retval; 
     }
 
+    if (argc == 4) {
+        matcher = yar_matcher_new(MATCHER_FLG_NOCASE);
+        if (matcher == NULL || yar_matcher_load(matcher, argv[3]) != 0 ||
+                yar_matcher_compile(matcher) != 0) {
+            perror(argv[3]);
+            yar_matcher_free(matcher);
+            return retval;
+        }
+    }
+
+    _tmpl = yar_tmpl_new(_req, sizeof(_req)-1);
+    if (_tmpl == NULL) {
+        perror("yar_tmpl_new");
+        yar_matcher_free(matcher);
+        return retval;
+    }
+
+    _out = yar_sink_new(STDOUT_FILENO, 0);
+    if (_out == NULL) {
+        perror("yar_sink_new");
+        yar_tmpl_free(_tmpl);
+        yar_matcher_free(matcher);
+        return retval;
+    }
+
     memset(&cli, 0, sizeof(cli));
     cli.proto = ADDRPROTO_TCP;
     cli.on_established = on_established;
-    cli.on_read = on_read;
-    cli.read_validator = read_validator;
+    cli.on_read = matcher != NULL ? on_read_classify : on_read;
+    cli.read_validator_inc = yar_rv_crlfcrlf_inc;
+    cli.matcher = matcher;
+    cli.sink = _out;
     cli.ncc = NCURRCONNS;
     cli.tr = TICKRATE;
     cli.to = IO_TIMEOUT_US;
@@ -90,6 +141,13 @@ int main(int argc, char *argv[])
         retval = EXIT_SUCCESS;
     }
     
+    if (yar_sink_close(_out) != 0) {
+        perror("write");
+        retval = EXIT_FAILURE;
+    }
+
+    yar_tmpl_free(_tmpl);
+    yar_matcher_free(matcher);
     return retval; 
 }
 
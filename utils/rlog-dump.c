@@ -0,0 +1,265 @@
+/*
+Copyright (c) 2013, Sebastian Cato
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * rlog-dump --
+ *     print or count the records of binary result logs, see rlog.h
+ *
+ * example usage:
+ *     ./rlog-dump results.rlog
+ *     ./rlog-dump -s established,read -p 80-443 results.rlog
+ *     ./rlog-dump -c -a 10.0.0.0-10.0.255.255 -t 1700000000-1700003600 *.rlog
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <arpa/inet.h>
+#include <yarlib/yar.h>
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-c] [-x] [-s status,...] [-p port-port] "
+            "[-a ipv4-ipv4] [-t sec-sec] <file>...\n", argv0);
+}
+
+static int parse_statuses(const char *str, uint32_t *statuses)
+{
+    char *copy, *tok, *save = NULL;
+    unsigned int i;
+
+    copy = strdup(str);
+    if (copy == NULL) {
+        return -1;
+    }
+
+    for (tok = strtok_r(copy, ",", &save); tok != NULL; 
+            tok = strtok_r(NULL, ",", &save)) {
+        for (i = 1; i <= RLOG_STATUS_MAX; i++) {
+            if (strcmp(tok, yar_rlog_status_str(i)) == 0) {
+                *statuses |= 1u << i;
+                break;
+            }
+        }
+
+        if (i > RLOG_STATUS_MAX) {
+            free(copy);
+            return -1;
+        }
+    }
+
+    free(copy);
+    return 0;
+}
+
+/* "lo-hi" or a single value */
+static int parse_range(const char *str, uint64_t max, uint64_t *lo, 
+        uint64_t *hi)
+{
+    char *end;
+
+    errno = 0;
+    *lo = strtoull(str, &end, 10);
+    if (end == str || errno != 0) {
+        return -1;
+    }
+
+    *hi = *lo;
+    if (*end == '-') {
+        str = end + 1;
+        *hi = strtoull(str, &end, 10);
+        if (end == str || errno != 0) {
+            return -1;
+        }
+    }
+
+    return *end == '\0' && *lo <= *hi && *hi <= max ? 0 : -1;
+}
+
+static int parse_v4range(const char *str, uint32_t *lo, uint32_t *hi)
+{
+    char buf[INET_ADDRSTRLEN * 2];
+    struct in_addr in;
+    char *dash;
+
+    if (strlen(str) >= sizeof(buf)) {
+        return -1;
+    }
+
+    strcpy(buf, str);
+    dash = strchr(buf, '-');
+    if (dash != NULL) {
+        *dash++ = '\0';
+    }
+
+    if (inet_pton(AF_INET, buf, &in) != 1) {
+        return -1;
+    }
+
+    *lo = *hi = ntohl(in.s_addr);
+    if (dash != NULL) {
+        if (inet_pton(AF_INET, dash, &in) != 1) {
+            return -1;
+        }
+
+        *hi = ntohl(in.s_addr);
+    }
+
+    return *lo <= *hi ? 0 : -1;
+}
+
+static void print_payload(const unsigned char *data, size_t len)
+{
+    size_t i;
+
+    putchar('\t');
+    for (i = 0; i < len; i++) {
+        if (data[i] == '\\') {
+            fputs("\\\\", stdout);
+        } else if (data[i] >= 0x20 && data[i] < 0x7f) {
+            putchar(data[i]);
+        } else {
+            printf("\\x%02x", data[i]);
+        }
+    }
+}
+
+static void print_rec(const struct yar_rlog_rec *rec, int payload)
+{
+    char addr[INET6_ADDRSTRLEN];
+
+    inet_ntop(rec->family == RLOG_AF_INET ? AF_INET : AF_INET6, rec->addr, 
+            addr, sizeof(addr));
+    printf("%" PRIu64 ".%06" PRIu64 " %.3f %s %s %u", rec->ts / 1000000,
+            rec->ts % 1000000, rec->elapsed / 1000.0, 
+            yar_rlog_status_str(rec->status), addr, rec->port);
+    if (rec->status == RLOG_STATUS_ERROR) {
+        printf(" %s", strerror(rec->err));
+    }
+
+    if (payload && rec->paylen > 0) {
+        print_payload(RLOG_PAYLOAD(rec), rec->paylen);
+    }
+
+    putchar('\n');
+}
+
+int main(int argc, char *argv[])
+{
+    struct yar_rlog_filter filter;
+    const struct yar_rlog_rec *rec;
+    yar_rlog_reader_t *r;
+    uint64_t lo, hi, counts[RLOG_STATUS_MAX + 1];
+    int ch, count = 0, payload = 0, retval = EXIT_SUCCESS;
+    unsigned int i;
+
+    yar_rlog_filter_init(&filter);
+    memset(counts, 0, sizeof(counts));
+    while ((ch = getopt(argc, argv, "cxs:p:a:t:")) != -1) {
+        switch (ch) {
+        case 'c':
+            count = 1;
+            break;
+        case 'x':
+            payload = 1;
+            break;
+        case 's':
+            if (parse_statuses(optarg, &filter.statuses) < 0) {
+                fprintf(stderr, "invalid status list: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'p':
+            if (parse_range(optarg, UINT16_MAX, &lo, &hi) < 0) {
+                fprintf(stderr, "invalid port range: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+
+            filter.portmin = (uint16_t)lo;
+            filter.portmax = (uint16_t)hi;
+            break;
+        case 'a':
+            if (parse_v4range(optarg, &filter.v4min, &filter.v4max) < 0) {
+                fprintf(stderr, "invalid address range: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 't':
+            if (parse_range(optarg, UINT64_MAX / 1000000, &lo, &hi) < 0) {
+                fprintf(stderr, "invalid time range: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+
+            filter.tsmin = lo * 1000000;
+            filter.tsmax = hi * 1000000 + 999999;
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for (; optind < argc; optind++) {
+        r = yar_rlog_reader_open(argv[optind]);
+        if (r == NULL) {
+            perror(argv[optind]);
+            retval = EXIT_FAILURE;
+            continue;
+        }
+
+        errno = 0;
+        while ((rec = yar_rlog_reader_next(r, &filter)) != NULL) {
+            if (count) {
+                counts[rec->status <= RLOG_STATUS_MAX ? rec->status : 0]++;
+            } else {
+                print_rec(rec, payload);
+            }
+        }
+
+        if (errno != 0) {
+            fprintf(stderr, "%s: corrupt log\n", argv[optind]);
+            retval = EXIT_FAILURE;
+        }
+
+        yar_rlog_reader_close(r);
+    }
+
+    if (count) {
+        for (i = 0; i <= RLOG_STATUS_MAX; i++) {
+            if (counts[i] > 0) {
+                printf("%s %" PRIu64 "\n", yar_rlog_status_str(i), counts[i]);
+            }
+        }
+    }
+
+    return retval;
+}
@@ -26,46 +26,86 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <yarlib/yar.h>
 
 #define NCURRCONNS      50
 #define TICKRATE        10
 #define IO_TIMEOUT_US   5000000
 
+static yar_sink_t *_out;
+static yar_rlog_t *_log; /* binary results instead of text, if set */
+
 static void on_established(struct yar_endpoint *ep)
 {
     char addr[ADDR_STRLEN];
     char port[16];
     
-    yar_port_to_str(ep->port, port, sizeof(port));
-    yar_addr_to_str(&ep->addr, addr);
-    printf("open %s %s\n", addr, port);
+    if (_log == NULL) {
+        yar_port_to_str(ep->port, port, sizeof(port));
+        yar_addr_to_str(&ep->addr, addr);
+        yar_sink_printf(_out, "open %s %s\n", addr, port);
+    }
+
     yar_endpoint_terminate(ep);
 }
 
 int main(int argc, char *argv[])
 {
     struct yar_client cli;
+    int fd = STDOUT_FILENO, retval = EXIT_SUCCESS;
 
-    if (argc != 3) {
-        fprintf(stderr, "usage: %s <addrspec> <portspec>\n",
+    if (argc != 3 && argc != 4) {
+        fprintf(stderr, "usage: %s <addrspec> <portspec> [rlogfile]\n",
                 argv[0]);
         return EXIT_FAILURE;
     }
 
+    if (argc == 4) {
+        fd = open(argv[3], O_WRONLY|O_CREAT|O_TRUNC, 0644);
+        if (fd < 0) {
+            perror(argv[3]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    _out = yar_sink_new(fd, 0);
+    if (_out == NULL) {
+        perror("yar_sink_new");
+        return EXIT_FAILURE;
+    }
+
+    if (argc == 4 && (_log = yar_rlog_new(_out, 0)) == NULL) {
+        perror("yar_rlog_new");
+        yar_sink_close(_out);
+        return EXIT_FAILURE;
+    }
+
     memset(&cli, 0, sizeof(cli));
     cli.proto = ADDRPROTO_TCP;
     cli.on_established = on_established;
     cli.tr = TICKRATE;
     cli.ncc = NCURRCONNS;
     cli.to = IO_TIMEOUT_US;
+    cli.sink = _out;
+    cli.rlog = _log;
 
     if (yar_connect(&cli, argv[1], argv[2]) != 0) {
         fprintf(stderr, "connection initiation failed\n");
-        return EXIT_FAILURE;
+        retval = EXIT_FAILURE;
+    } else {
+        yar_main();
     }
     
-    yar_main();
-    return EXIT_SUCCESS;
-}
+    if (yar_rlog_free(_log) != 0 || yar_sink_close(_out) != 0) {
+        perror("write");
+        retval = EXIT_FAILURE;
+    }
+
+    if (fd != STDOUT_FILENO) {
+        close(fd);
+    }
 
+    return retval;
+}
@@ -0,0 +1,444 @@
+/*
+Copyright (c) 2013, Sebastian Cato
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "match.h"
+
+/* set in the transition table for target states with matches */
+#define MATCH_FLG_OUT   0x80000000u
+#define MATCH_MAXSTATES 0x7fffffffu
+
+#define MATCH_INITIAL_NODES 64
+#define MATCH_INITIAL_OUTS  16
+
+/* trie node. Children are kept in sibling lists until the matcher is 
+   compiled, list indices are offset by one so that zero terminates */
+struct match_node {
+    unsigned int child;
+    unsigned int sibling;
+    unsigned int fail;
+    unsigned int out;       /* first entry in the output list */
+    unsigned char byte;
+};
+
+/* output lists share their tails: a state reports its own patterns and 
+   then those of its failure state */
+struct match_out {
+    unsigned int id;
+    unsigned int next;
+};
+
+struct yar_matcher {
+    unsigned int flags;
+
+    struct match_node *nodes;
+    size_t nnodes;
+    size_t nodecap;
+
+    struct match_out *outs;
+    size_t nouts;
+    size_t outcap;
+
+    /* set by yar_matcher_compile. States are row offsets into delta, so
+       the root is state 0 */
+    unsigned char cls[256];
+    unsigned int nclasses;
+    unsigned int *delta;
+};
+
+static int match_grow(void **arr, size_t *cap, size_t n, size_t size,
+        size_t initial)
+{
+    size_t newcap;
+    void *tmp;
+
+    if (n < *cap) {
+        return 0;
+    }
+
+    newcap = *cap == 0 ? initial : *cap * 2;
+    tmp = realloc(*arr, newcap * size);
+    if (tmp == NULL) {
+        return -1;
+    }
+
+    *arr = tmp;
+    *cap = newcap;
+    return 0;
+}
+
+static int match_node_new(yar_matcher_t *m, unsigned char byte, 
+        unsigned int *index)
+{
+    if (m->nnodes >= MATCH_MAXSTATES ||
+            match_grow((void **)&m->nodes, &m->nodecap, m->nnodes, 
+            sizeof(*m->nodes), MATCH_INITIAL_NODES) < 0) {
+        return -1;
+    }
+
+    memset(&m->nodes[m->nnodes], 0, sizeof(*m->nodes));
+    m->nodes[m->nnodes].byte = byte;
+    *index = (unsigned int)m->nnodes++;
+    return 0;
+}
+
+yar_matcher_t *yar_matcher_new(unsigned int flags)
+{
+    yar_matcher_t *m;
+    unsigned int root;
+
+    m = calloc(1, sizeof(yar_matcher_t));
+    if (m == NULL) {
+        return NULL;
+    }
+
+    m->flags = flags;
+    if (match_node_new(m, 0, &root) < 0) {
+        free(m);
+        return NULL;
+    }
+
+    return m;
+}
+
+void yar_matcher_free(yar_matcher_t *m)
+{
+    if (m != NULL) {
+        free(m->nodes);
+        free(m->outs);
+        free(m->delta);
+        free(m);
+    }
+}
+
+int yar_matcher_add(yar_matcher_t *m, unsigned int id, const void *pattern,
+        size_t len)
+{
+    const unsigned char *p = pattern;
+    unsigned int curr = 0, next, child;
+    unsigned char byte;
+    size_t i;
+
+    assert(m != NULL);
+    assert(pattern != NULL);
+
+    if (m->delta != NULL || len == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (i = 0; i < len; i++) {
+        byte = (m->flags & MATCHER_FLG_NOCASE) ? (unsigned char)tolower(p[i]) :
+                p[i];
+        for (child = m->nodes[curr].child; child != 0; 
+                child = m->nodes[child - 1].sibling) {
+            if (m->nodes[child - 1].byte == byte) {
+                break;
+            }
+        }
+
+        if (child != 0) {
+            curr = child - 1;
+            continue;
+        }
+
+        if (match_node_new(m, byte, &next) < 0) {
+            return -1;
+        }
+
+        m->nodes[next].sibling = m->nodes[curr].child;
+        m->nodes[curr].child = next + 1;
+        curr = next;
+    }
+
+    if (match_grow((void **)&m->outs, &m->outcap, m->nouts, 
+            sizeof(*m->outs), MATCH_INITIAL_OUTS) < 0) {
+        return -1;
+    }
+
+    m->outs[m->nouts].id = id;
+    m->outs[m->nouts].next = m->nodes[curr].out;
+    m->nodes[curr].out = (unsigned int)++m->nouts;
+    return 0;
+}
+
+static int match_hexval(int ch)
+{
+    if (ch >= '0' && ch <= '9') {
+        return ch - '0';
+    } else if (ch >= 'a' && ch <= 'f') {
+        return ch - 'a' + 10;
+    } else if (ch >= 'A' && ch <= 'F') {
+        return ch - 'A' + 10;
+    }
+
+    return -1;
+}
+
+/* unescape a pattern in place, returns its length or -1 */
+static long match_unescape(char *s)
+{
+    char *src = s, *dst = s;
+    int hi, lo;
+
+    while (*src != '\0') {
+        if (*src != '\\') {
+            *dst++ = *src++;
+            continue;
+        }
+
+        switch (src[1]) {
+        case '\\':
+            *dst++ = '\\';
+            break;
+        case 'r':
+            *dst++ = '\r';
+            break;
+        case 'n':
+            *dst++ = '\n';
+            break;
+        case 't':
+            *dst++ = '\t';
+            break;
+        case 'x':
+            if ((hi = match_hexval(src[2])) < 0 || 
+                    (lo = match_hexval(src[3])) < 0) {
+                return -1;
+            }
+
+            *dst++ = (char)(hi << 4 | lo);
+            src += 2;
+            break;
+        default:
+            return -1;
+        }
+
+        src += 2;
+    }
+
+    return (long)(dst - s);
+}
+
+int yar_matcher_load(yar_matcher_t *m, const char *path)
+{
+    FILE *fp;
+    char *line = NULL, *cptr, *end;
+    size_t linecap = 0;
+    ssize_t linelen;
+    unsigned long id;
+    long len;
+    int ret = 0, err = 0;
+
+    assert(m != NULL);
+    assert(path != NULL);
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+
+    while ((linelen = getline(&line, &linecap, fp)) > 0) {
+        while (linelen > 0 && 
+                (line[linelen-1] == '\n' || line[linelen-1] == '\r')) {
+            line[--linelen] = '\0';
+        }
+
+        for (cptr = line; isspace((unsigned char)*cptr); cptr++);
+        if (*cptr == '\0' || *cptr == '#') {
+            continue;
+        }
+
+        errno = 0;
+        id = strtoul(cptr, &end, 10);
+        if (end == cptr || errno != 0 || id > (unsigned int)-1 || 
+                !isspace((unsigned char)*end)) {
+            err = EINVAL;
+            break;
+        }
+
+        for (cptr = end; isspace((unsigned char)*cptr); cptr++);
+        if ((len = match_unescape(cptr)) <= 0) {
+            err = EINVAL;
+            break;
+        }
+
+        if (yar_matcher_add(m, (unsigned int)id, cptr, (size_t)len) < 0) {
+            err = errno;
+            break;
+        }
+    }
+
+    if (err == 0 && ferror(fp)) {
+        err = EIO;
+    }
+
+    free(line);
+    fclose(fp);
+    if (err != 0) {
+        errno = err;
+        ret = -1;
+    }
+
+    return ret;
+}
+
+/* maps each byte used in a pattern to a class of its own, and all other
+   bytes to class 0 */
+static void match_build_classes(yar_matcher_t *m)
+{
+    unsigned char used[256];
+    size_t i;
+    int key;
+
+    memset(used, 0, sizeof(used));
+    for (i = 1; i < m->nnodes; i++) {
+        used[m->nodes[i].byte] = 1;
+    }
+
+    m->nclasses = 1;
+    memset(m->cls, 0, sizeof(m->cls));
+    for (i = 0; i < 256; i++) {
+        if (used[i] && !((m->flags & MATCHER_FLG_NOCASE) && isupper((int)i))) {
+            m->cls[i] = (unsigned char)m->nclasses++;
+        }
+    }
+
+    if (m->flags & MATCHER_FLG_NOCASE) {
+        for (i = 0; i < 256; i++) {
+            key = tolower((int)i);
+            if (key != (int)i) {
+                m->cls[i] = m->cls[key];
+            }
+        }
+    }
+}
+
+int yar_matcher_compile(yar_matcher_t *m)
+{
+    unsigned int *queue, *row, *frow, u, v, child, ncl;
+    size_t head = 0, tail = 0, i;
+    unsigned int o;
+
+    assert(m != NULL);
+
+    if (m->delta != NULL) {
+        return 0;
+    }
+
+    match_build_classes(m);
+    ncl = m->nclasses;
+    if (m->nnodes > MATCH_MAXSTATES / ncl) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    m->delta = calloc(m->nnodes * ncl, sizeof(*m->delta));
+    queue = malloc(m->nnodes * sizeof(*queue));
+    if (m->delta == NULL || queue == NULL) {
+        free(m->delta);
+        free(queue);
+        m->delta = NULL;
+        return -1;
+    }
+
+    /* breadth first, so that failure states are complete before the 
+       states that refer to them */
+    queue[tail++] = 0;
+    while (head < tail) {
+        u = queue[head++];
+        row = m->delta + (size_t)u * ncl;
+        if (u != 0) {
+            frow = m->delta + (size_t)m->nodes[u].fail * ncl;
+            memcpy(row, frow, ncl * sizeof(*row));
+        }
+
+        for (child = m->nodes[u].child; child != 0; 
+                child = m->nodes[v].sibling) {
+            v = child - 1;
+            /* the failure state of v is where u's failure state goes on
+               the same byte. Depth one states fail to the root */
+            m->nodes[v].fail = u == 0 ? 0 : 
+                    (row[m->cls[m->nodes[v].byte]] & ~MATCH_FLG_OUT) / ncl;
+            if (m->nodes[v].out == 0) {
+                m->nodes[v].out = m->nodes[m->nodes[v].fail].out;
+            } else {
+                for (o = m->nodes[v].out; m->outs[o-1].next != 0; 
+                        o = m->outs[o-1].next);
+                m->outs[o-1].next = m->nodes[m->nodes[v].fail].out;
+            }
+
+            row[m->cls[m->nodes[v].byte]] = v * ncl | 
+                    (m->nodes[v].out != 0 ? MATCH_FLG_OUT : 0);
+            queue[tail++] = v;
+        }
+    }
+
+    /* the trie links are not needed anymore */
+    for (i = 0; i < m->nnodes; i++) {
+        m->nodes[i].child = m->nodes[i].sibling = 0;
+    }
+
+    free(queue);
+    return 0;
+}
+
+unsigned int yar_matcher_scan(const yar_matcher_t *m, unsigned int state,
+        const void *data, size_t len, yar_match_cb cb, void *cbdata)
+{
+    const unsigned char *p = data;
+    const unsigned int *delta;
+    const unsigned char *cls;
+    unsigned int t, o;
+    size_t i;
+
+    assert(m != NULL);
+    assert(m->delta != NULL);
+
+    delta = m->delta;
+    cls = m->cls;
+    for (i = 0; i < len; i++) {
+        t = delta[state + cls[p[i]]];
+        state = t & ~MATCH_FLG_OUT;
+        if ((t & MATCH_FLG_OUT) && cb != NULL) {
+            for (o = m->nodes[state / m->nclasses].out; o != 0; 
+                    o = m->outs[o-1].next) {
+                cb(m->outs[o-1].id, i + 1, cbdata);
+            }
+        }
+    }
+
+    return state;
+}
+
+unsigned int yar_matcher_nstates(const yar_matcher_t *m)
+{
+    assert(m != NULL);
+    return (unsigned int)m->nnodes;
+}
@@ -0,0 +1,94 @@
+/*
+Copyright (c) 2013, Sebastian Cato
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef __MATCH_H
+#define __MATCH_H
+
+#include <stddef.h>
+
+/**
+ * Multi-pattern matcher. Patterns are added to a matcher which is then 
+ * compiled into a DFA (an Aho-Corasick automaton with all failure 
+ * transitions resolved), so that scanning costs one table lookup per 
+ * byte regardless of the number of patterns. Input bytes are mapped to
+ * equivalence classes first, which keeps the table small. The scan state
+ * is a single unsigned int, so input can be scanned in segments as it 
+ * arrives.
+ */
+
+typedef struct yar_matcher yar_matcher_t;
+
+/* yar_matcher_new flags */
+#define MATCHER_FLG_NOCASE  1 /* case-insensitive ASCII matching */
+
+/* called for each match with the pattern ID and the offset of the byte
+   following the match, relative to the start of the scanned segment */
+typedef void (*yar_match_cb)(unsigned int id, size_t end, void *data);
+
+yar_matcher_t *yar_matcher_new(unsigned int flags);
+void yar_matcher_free(yar_matcher_t *m);
+
+/**
+ * yar_matcher_add --
+ *     add a pattern to an uncompiled matcher. IDs need not be unique
+ *
+ * @return -1 on error, 0 on success
+ */
+int yar_matcher_add(yar_matcher_t *m, unsigned int id, const void *pattern,
+        size_t len);
+
+/**
+ * yar_matcher_load --
+ *     add the patterns in a file. Each line holds a pattern ID and a 
+ *     pattern, separated by whitespace. Patterns extend to the end of 
+ *     the line and may contain the escapes \\, \r, \n, \t and \xHH. Empty
+ *     lines and lines starting with '#' are ignored
+ *
+ * @return -1 on error, with errno set to EINVAL on syntax errors, 
+ *         0 on success
+ */
+int yar_matcher_load(yar_matcher_t *m, const char *path);
+
+/**
+ * yar_matcher_compile --
+ *     build the DFA. No patterns can be added afterwards
+ *
+ * @return -1 on error, 0 on success
+ */
+int yar_matcher_compile(yar_matcher_t *m);
+
+/**
+ * yar_matcher_scan --
+ *     scan a segment of input starting in state, which is 0 initially,
+ *     and call cb for each match. A match that ends in this segment is 
+ *     reported even if it started in an earlier one
+ *
+ * @return the state to continue scanning from
+ */
+unsigned int yar_matcher_scan(const yar_matcher_t *m, unsigned int state,
+        const void *data, size_t len, yar_match_cb cb, void *cbdata);
+
+unsigned int yar_matcher_nstates(const yar_matcher_t *m);
+
+#endif
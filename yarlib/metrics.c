@@ -0,0 +1,298 @@
+/*
+Copyright (c) 2013, Sebastian Cato
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "metrics.h"
+
+static unsigned int hist_index(uint32_t v)
+{
+    unsigned int k;
+
+    if (v < HIST_SUB) {
+        return v;
+    }
+
+    k = 31 - (unsigned int)__builtin_clz(v);
+    return ((k - HIST_SUBBITS + 1) << HIST_SUBBITS) + 
+            ((v >> (k - HIST_SUBBITS)) & (HIST_SUB - 1));
+}
+
+/* the highest value counted in bucket i */
+static uint32_t hist_highest(unsigned int i)
+{
+    unsigned int b = i >> HIST_SUBBITS, s = i & (HIST_SUB - 1);
+    uint64_t lo;
+
+    if (b == 0) {
+        return s;
+    }
+
+    lo = (uint64_t)(HIST_SUB + s) << (b - 1);
+    return (uint32_t)(lo + ((uint64_t)1 << (b - 1)) - 1);
+}
+
+void yar_hist_record(yar_hist_t *h, uint64_t value)
+{
+    uint32_t v;
+
+    assert(h != NULL);
+
+    v = value > UINT32_MAX ? UINT32_MAX : (uint32_t)value;
+    if (h->n == 0 || v < h->min) {
+        h->min = v;
+    }
+
+    if (v > h->max) {
+        h->max = v;
+    }
+
+    h->n++;
+    h->sum += v;
+    h->counts[hist_index(v)]++;
+}
+
+void yar_hist_merge(yar_hist_t *dst, const yar_hist_t *src)
+{
+    unsigned int i;
+
+    assert(dst != NULL);
+    assert(src != NULL);
+
+    if (src->n == 0) {
+        return;
+    }
+
+    if (dst->n == 0 || src->min < dst->min) {
+        dst->min = src->min;
+    }
+
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+
+    dst->n += src->n;
+    dst->sum += src->sum;
+    for (i = 0; i < HIST_NBUCKETS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+}
+
+uint32_t yar_hist_percentile(const yar_hist_t *h, double p)
+{
+    uint64_t rank, seen = 0;
+    uint32_t v;
+    unsigned int i;
+
+    assert(h != NULL);
+
+    if (h->n == 0) {
+        return 0;
+    } else if (p <= 0.0) {
+        return h->min;
+    } else if (p >= 100.0) {
+        return h->max;
+    }
+
+    rank = (uint64_t)(p / 100.0 * (double)h->n + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    for (i = 0; i < HIST_NBUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            v = hist_highest(i);
+            return v > h->max ? h->max : v;
+        }
+    }
+
+    return h->max;
+}
+
+static int metrics_print_hist(yar_sink_t *sink, const char *name,
+        const char *hname, const yar_hist_t *h)
+{
+    if (h->n == 0) {
+        return 0;
+    }
+
+    return yar_sink_printf(sink, 
+            "%s.%s.count %llu\n%s.%s.min %u\n%s.%s.p50 %u\n"
+            "%s.%s.p90 %u\n%s.%s.p99 %u\n%s.%s.p999 %u\n%s.%s.max %u\n",
+            name, hname, (unsigned long long)h->n,
+            name, hname, h->min, 
+            name, hname, yar_hist_percentile(h, 50.0),
+            name, hname, yar_hist_percentile(h, 90.0),
+            name, hname, yar_hist_percentile(h, 99.0),
+            name, hname, yar_hist_percentile(h, 99.9),
+            name, hname, h->max);
+}
+
+int yar_metrics_print(yar_sink_t *sink, const char *name, 
+        const struct yar_metrics *m)
+{
+    static const struct {
+        const char *name;
+        size_t off;
+    } counters[] = {
+        {"dispatched", offsetof(struct yar_metrics, dispatched)},
+        {"established", offsetof(struct yar_metrics, established)},
+        {"refused", offsetof(struct yar_metrics, refused)},
+        {"timedout", offsetof(struct yar_metrics, timedout)},
+        {"eof", offsetof(struct yar_metrics, eof)},
+        {"errors", offsetof(struct yar_metrics, errors)},
+        {"messages", offsetof(struct yar_metrics, messages)},
+        {"bytes_in", offsetof(struct yar_metrics, bytes_in)},
+        {"bytes_out", offsetof(struct yar_metrics, bytes_out)},
+        {"live", offsetof(struct yar_metrics, live)},
+    };
+    uint64_t val;
+    size_t i;
+
+    assert(sink != NULL);
+    assert(name != NULL);
+    assert(m != NULL);
+
+    for (i = 0; i < sizeof(counters) / sizeof(*counters); i++) {
+        memcpy(&val, (const char *)m + counters[i].off, sizeof(val));
+        if (val > 0 && yar_sink_printf(sink, "%s.%s %llu\n", name, 
+                counters[i].name, (unsigned long long)val) < 0) {
+            return -1;
+        }
+    }
+
+    for (i = 0; i < METRICS_NERRNO; i++) {
+        if (m->errnos[i] > 0 && yar_sink_printf(sink, "%s.errno.%zu %llu\n", 
+                name, i, (unsigned long long)m->errnos[i]) < 0) {
+            return -1;
+        }
+    }
+
+    if (metrics_print_hist(sink, name, "connect_us", &m->connect_us) < 0 ||
+            metrics_print_hist(sink, name, "ttfb_us", &m->ttfb_us) < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+const char *yar_cbtype_str(unsigned int type)
+{
+    static const char *names[CBTYPE_NTYPES] = {
+        "established", "read", "eof", "timeout", "error", "write_drained",
+        "ticker",
+    };
+
+    return type < CBTYPE_NTYPES ? names[type] : "unknown";
+}
+
+void yar_profile_record(struct yar_profile *p, unsigned int type, 
+        uint64_t usec, const yar_addr_t *addr, yar_port_t port)
+{
+    struct yar_slowcb *slow;
+    size_t i;
+
+    assert(p != NULL);
+    assert(type < CBTYPE_NTYPES);
+
+    yar_hist_record(&p->cb_us[type], usec);
+    if (usec > UINT32_MAX) {
+        usec = UINT32_MAX;
+    }
+
+    if (p->nslowest == PROFILE_NSLOWEST && 
+            usec <= p->slowest[PROFILE_NSLOWEST - 1].usec) {
+        return;
+    }
+
+    /* insertion sort, the list is short */
+    i = p->nslowest < PROFILE_NSLOWEST ? p->nslowest++ : 
+            PROFILE_NSLOWEST - 1;
+    for (; i > 0 && p->slowest[i - 1].usec < usec; i--) {
+        p->slowest[i] = p->slowest[i - 1];
+    }
+
+    slow = &p->slowest[i];
+    slow->type = type;
+    slow->usec = (uint32_t)usec;
+    slow->port = port;
+    if (addr != NULL) {
+        slow->addr = *addr;
+    } else {
+        memset(&slow->addr, 0, sizeof(slow->addr));
+    }
+}
+
+int yar_profile_print(yar_sink_t *sink, const char *name,
+        const struct yar_profile *p)
+{
+    const struct yar_slowcb *slow;
+    char hname[32], addrbuf[ADDR_STRLEN], portbuf[16];
+    unsigned int i;
+
+    assert(sink != NULL);
+    assert(name != NULL);
+    assert(p != NULL);
+
+    for (i = 0; i < CBTYPE_NTYPES; i++) {
+        if (p->ncalls[i] == 0) {
+            continue;
+        }
+
+        snprintf(hname, sizeof(hname), "cb.%s_us", yar_cbtype_str(i));
+        if (yar_sink_printf(sink, "%s.cb.%s.calls %llu\n", name, 
+                yar_cbtype_str(i), (unsigned long long)p->ncalls[i]) < 0 ||
+                metrics_print_hist(sink, name, hname, &p->cb_us[i]) < 0) {
+            return -1;
+        }
+    }
+
+    if (metrics_print_hist(sink, name, "lag_us", &p->lag_us) < 0) {
+        return -1;
+    }
+
+    for (i = 0; i < p->nslowest; i++) {
+        slow = &p->slowest[i];
+        if (slow->addr.af == 0) {
+            strcpy(addrbuf, "-");
+            strcpy(portbuf, "-");
+        } else {
+            yar_addr_to_str(&slow->addr, addrbuf);
+            yar_port_to_str(slow->port, portbuf, sizeof(portbuf));
+        }
+
+        if (yar_sink_printf(sink, "%s.slowest.%u %s %u %s %s\n", name, i,
+                yar_cbtype_str(slow->type), slow->usec, addrbuf, 
+                portbuf) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,149 @@
+/*
+Copyright (c) 2013, Sebastian Cato
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef __METRICS_H
+#define __METRICS_H
+
+#include <stdint.h>
+
+#include "sink.h"
+#include "addr.h"
+#include "port.h"
+
+/**
+ * Counters and latency histograms. The library runs in one thread, so
+ * they are plain integers which are incremented in place, and a snapshot
+ * is a copy.
+ *
+ * Histograms are log-linear, like HDR histograms: values below 
+ * HIST_SUB are counted exactly, and each power of two above that is split
+ * into HIST_SUB buckets, so a recorded value is off by less than 
+ * 1 / HIST_SUB. Values are in microseconds and saturate at UINT32_MAX.
+ */
+#define HIST_SUBBITS    4
+#define HIST_SUB        (1 << HIST_SUBBITS)
+#define HIST_NBUCKETS   ((32 - HIST_SUBBITS + 1) * HIST_SUB)
+
+typedef struct yar_hist {
+    uint64_t n;
+    uint64_t sum;
+    uint32_t min;
+    uint32_t max;
+    uint64_t counts[HIST_NBUCKETS];
+} yar_hist_t;
+
+void yar_hist_record(yar_hist_t *h, uint64_t value);
+void yar_hist_merge(yar_hist_t *dst, const yar_hist_t *src);
+
+/**
+ * yar_hist_percentile --
+ *     the highest value equivalent to the one at percentile p (0-100)
+ *
+ * @return 0 if the histogram is empty
+ */
+uint32_t yar_hist_percentile(const yar_hist_t *h, double p);
+
+/* errors are counted by errno value, values that do not fit in the
+   array are counted in the first slot */
+#define METRICS_NERRNO  136
+
+struct yar_metrics {
+    uint64_t dispatched;    /* connection attempts, including failed ones */
+    uint64_t established;   /* connected, or datagram endpoint answered */
+    uint64_t refused;       /* errors with ECONNREFUSED */
+    uint64_t timedout;
+    uint64_t eof;
+    uint64_t errors;
+    uint64_t messages;      /* messages passed to on_read */
+    uint64_t bytes_in;
+    uint64_t bytes_out;     /* written, or queued when the endpoint closed */
+    uint64_t live;          /* endpoints currently open */
+    uint64_t errnos[METRICS_NERRNO];
+    yar_hist_t connect_us;  /* dispatch to established, new connections */
+    yar_hist_t ttfb_us;     /* dispatch to the first byte of input */
+};
+
+/**
+ * yar_metrics_print --
+ *     append the non-zero counters of m, and the count, min, p50, p90, 
+ *     p99, p99.9 and max of each non-empty histogram, to a sink as 
+ *     "<name>.<metric> <value>" lines
+ *
+ * @return -1 on error, 0 on success
+ */
+int yar_metrics_print(yar_sink_t *sink, const char *name, 
+        const struct yar_metrics *m);
+
+/* callback types, see struct yar_profile */
+#define CBTYPE_ESTABLISHED      0
+#define CBTYPE_READ             1
+#define CBTYPE_EOF              2
+#define CBTYPE_TIMEOUT          3
+#define CBTYPE_ERROR            4
+#define CBTYPE_WRITE_DRAINED    5
+#define CBTYPE_TICKER           6
+#define CBTYPE_NTYPES           7
+
+/* the slowest timed callbacks kept by a profile */
+#define PROFILE_NSLOWEST        8
+
+struct yar_slowcb {
+    unsigned int type;
+    uint32_t usec;
+    yar_addr_t addr;        /* af is 0 for tickers */
+    yar_port_t port;
+};
+
+/**
+ * Callback profile. Calls are counted by type, and the duration of one in
+ * every so many is recorded, along with the slowest ones and their 
+ * targets. Ticker lag is how late tickers run after their deadlines, 
+ * which is how long the event loop was kept busy by anything else.
+ */
+struct yar_profile {
+    uint64_t ncalls[CBTYPE_NTYPES];
+    yar_hist_t cb_us[CBTYPE_NTYPES];    /* durations of timed calls */
+    yar_hist_t lag_us;
+    struct yar_slowcb slowest[PROFILE_NSLOWEST]; /* slowest first */
+    size_t nslowest;
+};
+
+/* the name of a callback type, e.g. "read" */
+const char *yar_cbtype_str(unsigned int type);
+
+/* record the duration of a timed callback, addr is NULL for tickers */
+void yar_profile_record(struct yar_profile *p, unsigned int type, 
+        uint64_t usec, const yar_addr_t *addr, yar_port_t port);
+
+/**
+ * yar_profile_print --
+ *     append the call counts, the duration histograms, the ticker lag 
+ *     and the slowest callbacks of p to a sink, like yar_metrics_print
+ *
+ * @return -1 on error, 0 on success
+ */
+int yar_profile_print(yar_sink_t *sink, const char *name,
+        const struct yar_profile *p);
+
+#endif
@@ -0,0 +1,399 @@
+/*
+Copyright (c) 2013, Sebastian Cato
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <assert.h>
+
+#include "rlog.h"
+
+#define RLOG_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+struct yar_rlog {
+    yar_sink_t *out;
+    size_t maxpayload;
+
+    /* the current block: its header, followed by its records */
+    unsigned char *buf;
+    size_t len;
+    struct yar_rlog_block *blk;
+};
+
+struct yar_rlog_reader {
+    int fd;
+    const unsigned char *map;
+    size_t size;
+    size_t off;             /* offset of the next block */
+
+    /* the current block */
+    const unsigned char *rec;
+    const unsigned char *end;
+};
+
+static void yar_rlog_block_reset(struct yar_rlog_block *blk)
+{
+    memset(blk, 0, sizeof(*blk));
+    blk->magic = RLOG_BLOCK_MAGIC;
+    blk->tsmin = UINT64_MAX;
+    blk->v4min = UINT32_MAX;
+    blk->portmin = UINT16_MAX;
+}
+
+yar_rlog_t *yar_rlog_new(yar_sink_t *out, size_t maxpayload)
+{
+    struct yar_rlog_hdr hdr;
+    yar_rlog_t *l;
+
+    assert(out != NULL);
+
+    l = calloc(1, sizeof(yar_rlog_t));
+    if (l == NULL) {
+        return NULL;
+    }
+
+    /* a record always fits in an empty block */
+    l->buf = malloc(sizeof(struct yar_rlog_block) + RLOG_BLOCK_SIZE);
+    if (l->buf == NULL) {
+        free(l);
+        return NULL;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, RLOG_MAGIC, sizeof(RLOG_MAGIC));
+    hdr.version = RLOG_VERSION;
+    hdr.byteorder = RLOG_BYTEORDER;
+    if (yar_sink_write(out, &hdr, sizeof(hdr)) < 0) {
+        free(l->buf);
+        free(l);
+        return NULL;
+    }
+
+    l->out = out;
+    l->maxpayload = maxpayload < RLOG_MAX_PAYLOAD ? maxpayload : 
+            RLOG_MAX_PAYLOAD;
+    l->blk = (struct yar_rlog_block *)l->buf;
+    l->len = sizeof(struct yar_rlog_block);
+    yar_rlog_block_reset(l->blk);
+    return l;
+}
+
+int yar_rlog_flush(yar_rlog_t *l)
+{
+    int ret;
+
+    assert(l != NULL);
+
+    if (l->blk->nrecs == 0) {
+        return 0;
+    }
+
+    l->blk->len = (uint32_t)(l->len - sizeof(struct yar_rlog_block));
+    ret = yar_sink_write(l->out, l->buf, l->len);
+    l->len = sizeof(struct yar_rlog_block);
+    yar_rlog_block_reset(l->blk);
+    return ret;
+}
+
+int yar_rlog_free(yar_rlog_t *l)
+{
+    int ret = 0;
+
+    if (l != NULL) {
+        ret = yar_rlog_flush(l);
+        free(l->buf);
+        free(l);
+    }
+
+    return ret;
+}
+
+size_t yar_rlog_maxpayload(const yar_rlog_t *l)
+{
+    assert(l != NULL);
+    return l->maxpayload;
+}
+
+void yar_rlog_rec_set_addr(struct yar_rlog_rec *rec, 
+        const struct sockaddr *sa)
+{
+    const struct sockaddr_in *sin;
+    const struct sockaddr_in6 *sin6;
+
+    assert(rec != NULL);
+    assert(sa != NULL);
+
+    memset(rec->addr, 0, sizeof(rec->addr));
+    if (sa->sa_family == AF_INET) {
+        sin = (const struct sockaddr_in *)sa;
+        rec->family = RLOG_AF_INET;
+        rec->port = ntohs(sin->sin_port);
+        memcpy(rec->addr, &sin->sin_addr, sizeof(sin->sin_addr));
+    } else if (sa->sa_family == AF_INET6) {
+        sin6 = (const struct sockaddr_in6 *)sa;
+        rec->family = RLOG_AF_INET6;
+        rec->port = ntohs(sin6->sin6_port);
+        memcpy(rec->addr, &sin6->sin6_addr, sizeof(sin6->sin6_addr));
+    }
+}
+
+static void yar_rlog_block_index(struct yar_rlog_block *blk, 
+        const struct yar_rlog_rec *rec)
+{
+    uint32_t v4;
+
+    blk->nrecs++;
+    blk->statuses |= 1u << rec->status;
+    blk->families |= 1u << rec->family;
+    blk->tsmin = rec->ts < blk->tsmin ? rec->ts : blk->tsmin;
+    blk->tsmax = rec->ts > blk->tsmax ? rec->ts : blk->tsmax;
+    blk->portmin = rec->port < blk->portmin ? rec->port : blk->portmin;
+    blk->portmax = rec->port > blk->portmax ? rec->port : blk->portmax;
+    if (rec->family == RLOG_AF_INET) {
+        memcpy(&v4, rec->addr, sizeof(v4));
+        v4 = ntohl(v4);
+        blk->v4min = v4 < blk->v4min ? v4 : blk->v4min;
+        blk->v4max = v4 > blk->v4max ? v4 : blk->v4max;
+    }
+}
+
+void *yar_rlog_reserve(yar_rlog_t *l, const struct yar_rlog_rec *rec)
+{
+    struct yar_rlog_rec *dst;
+    size_t paylen, reclen;
+
+    assert(l != NULL);
+    assert(rec != NULL);
+    assert(rec->status <= RLOG_STATUS_MAX);
+
+    paylen = rec->paylen < l->maxpayload ? rec->paylen : l->maxpayload;
+    reclen = RLOG_ALIGN(sizeof(*rec) + paylen);
+    if (l->len + reclen > sizeof(struct yar_rlog_block) + RLOG_BLOCK_SIZE &&
+            yar_rlog_flush(l) < 0) {
+        return NULL;
+    }
+
+    dst = (struct yar_rlog_rec *)(l->buf + l->len);
+    memcpy(dst, rec, sizeof(*dst));
+    dst->reclen = (uint16_t)reclen;
+    dst->paylen = (uint16_t)paylen;
+    memset((unsigned char *)dst + sizeof(*dst) + paylen, 0, 
+            reclen - sizeof(*dst) - paylen);
+    yar_rlog_block_index(l->blk, dst);
+    l->len += reclen;
+    return dst + 1;
+}
+
+int yar_rlog_append(yar_rlog_t *l, const struct yar_rlog_rec *rec, 
+        const void *payload)
+{
+    void *dst;
+
+    dst = yar_rlog_reserve(l, rec);
+    if (dst == NULL) {
+        return -1;
+    }
+
+    if (payload != NULL) {
+        memcpy(dst, payload, ((const struct yar_rlog_rec *)dst - 1)->paylen);
+    }
+
+    return 0;
+}
+
+const char *yar_rlog_status_str(unsigned int status)
+{
+    static const char *names[] = {
+        "unknown", "established", "read", "eof", "timeout", "error"
+    };
+
+    return status <= RLOG_STATUS_MAX ? names[status] : names[0];
+}
+
+void yar_rlog_filter_init(struct yar_rlog_filter *f)
+{
+    assert(f != NULL);
+
+    memset(f, 0, sizeof(*f));
+    f->tsmax = UINT64_MAX;
+    f->portmax = UINT16_MAX;
+    f->v4max = UINT32_MAX;
+}
+
+yar_rlog_reader_t *yar_rlog_reader_open(const char *path)
+{
+    const struct yar_rlog_hdr *hdr;
+    yar_rlog_reader_t *r;
+    struct stat st;
+    void *map;
+    int fd;
+
+    assert(path != NULL);
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return NULL;
+    } else if ((size_t)st.st_size < sizeof(*hdr)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+
+    hdr = map;
+    if (memcmp(hdr->magic, RLOG_MAGIC, sizeof(RLOG_MAGIC)) != 0 ||
+            hdr->version != RLOG_VERSION || 
+            hdr->byteorder != RLOG_BYTEORDER) {
+        munmap(map, (size_t)st.st_size);
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    r = calloc(1, sizeof(yar_rlog_reader_t));
+    if (r == NULL) {
+        munmap(map, (size_t)st.st_size);
+        close(fd);
+        return NULL;
+    }
+
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+    r->fd = fd;
+    r->map = map;
+    r->size = (size_t)st.st_size;
+    r->off = sizeof(*hdr);
+    return r;
+}
+
+void yar_rlog_reader_close(yar_rlog_reader_t *r)
+{
+    if (r != NULL) {
+        munmap((void *)r->map, r->size);
+        close(r->fd);
+        free(r);
+    }
+}
+
+static int yar_rlog_block_match(const struct yar_rlog_block *blk,
+        const struct yar_rlog_filter *f)
+{
+    if ((f->statuses != 0 && (blk->statuses & f->statuses) == 0) ||
+            blk->tsmax < f->tsmin || blk->tsmin > f->tsmax ||
+            blk->portmax < f->portmin || blk->portmin > f->portmax) {
+        return 0;
+    }
+
+    if (f->v4min > 0 || f->v4max < UINT32_MAX) {
+        return blk->v4min <= blk->v4max && blk->v4max >= f->v4min && 
+                blk->v4min <= f->v4max;
+    }
+
+    return 1;
+}
+
+static int yar_rlog_rec_match(const struct yar_rlog_rec *rec,
+        const struct yar_rlog_filter *f)
+{
+    uint32_t v4;
+
+    if ((f->statuses != 0 && (f->statuses & (1u << rec->status)) == 0) ||
+            rec->ts < f->tsmin || rec->ts > f->tsmax ||
+            rec->port < f->portmin || rec->port > f->portmax) {
+        return 0;
+    }
+
+    if (f->v4min > 0 || f->v4max < UINT32_MAX) {
+        if (rec->family != RLOG_AF_INET) {
+            return 0;
+        }
+
+        memcpy(&v4, rec->addr, sizeof(v4));
+        v4 = ntohl(v4);
+        return v4 >= f->v4min && v4 <= f->v4max;
+    }
+
+    return 1;
+}
+
+const struct yar_rlog_rec *yar_rlog_reader_next(yar_rlog_reader_t *r,
+        const struct yar_rlog_filter *f)
+{
+    const struct yar_rlog_block *blk;
+    const struct yar_rlog_rec *rec;
+
+    assert(r != NULL);
+
+    for (;;) {
+        while (r->rec < r->end) {
+            rec = (const struct yar_rlog_rec *)r->rec;
+            if (rec->reclen < sizeof(*rec) || 
+                    rec->reclen > (size_t)(r->end - r->rec)) {
+                r->rec = r->end = NULL;
+                r->off = r->size;
+                errno = EINVAL;
+                return NULL;
+            }
+
+            r->rec += rec->reclen;
+            if (f == NULL || yar_rlog_rec_match(rec, f)) {
+                return rec;
+            }
+        }
+
+        if (r->size - r->off < sizeof(*blk)) {
+            return NULL;
+        }
+
+        blk = (const struct yar_rlog_block *)(r->map + r->off);
+        if (blk->magic != RLOG_BLOCK_MAGIC) {
+            errno = EINVAL;
+            return NULL;
+        } else if (blk->len > r->size - r->off - sizeof(*blk)) {
+            /* not completely written */
+            return NULL;
+        }
+
+        r->off += sizeof(*blk) + blk->len;
+        if (f == NULL || yar_rlog_block_match(blk, f)) {
+            r->rec = (const unsigned char *)(blk + 1);
+            r->end = r->rec + blk->len;
+        }
+    }
+}
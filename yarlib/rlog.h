@@ -0,0 +1,176 @@
+/*
+Copyright (c) 2013, Sebastian Cato
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef __RLOG_H
+#define __RLOG_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "sink.h"
+
+/**
+ * Binary result log. A log is a file header followed by blocks of 
+ * records. Each block starts with an index of what its records contain 
+ * (statuses, time, port and IPv4 address ranges), so that a reader can
+ * skip blocks that do not match a filter. Records are 8-byte aligned, in
+ * host byte order, and can be used in place from a mapped file.
+ *
+ * The writer appends complete blocks to a yar_sink, so it never blocks 
+ * the event loop. A log set as cli->rlog receives a record for each 
+ * outcome of each endpoint.
+ */
+
+#define RLOG_MAGIC          "YARRLOG"
+#define RLOG_VERSION        1
+#define RLOG_BYTEORDER      0x01020304
+#define RLOG_BLOCK_MAGIC    0x4b425259 /* "YRBK" */
+#define RLOG_BLOCK_SIZE     (128 * 1024)
+
+struct yar_rlog_hdr {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteorder;     /* RLOG_BYTEORDER, as written */
+};
+
+struct yar_rlog_block {
+    uint32_t magic;
+    uint32_t len;           /* bytes of records following the header */
+    uint32_t nrecs;
+    uint32_t statuses;      /* (1 << status) for each status present */
+    uint64_t tsmin;
+    uint64_t tsmax;
+    uint32_t v4min;         /* IPv4 address range, host byte order. */
+    uint32_t v4max;         /* v4min > v4max if there are no IPv4 records */
+    uint16_t portmin;
+    uint16_t portmax;
+    uint32_t families;      /* (1 << family) for each family present */
+};
+
+/* yar_rlog_rec.status */
+#define RLOG_STATUS_ESTABLISHED 1 /* connected, or datagram endpoint ready */
+#define RLOG_STATUS_READ        2 /* a message was passed to on_read */
+#define RLOG_STATUS_EOF         3
+#define RLOG_STATUS_TIMEOUT     4
+#define RLOG_STATUS_ERROR       5 /* err holds the errno value */
+#define RLOG_STATUS_MAX         5
+
+/* yar_rlog_rec.family */
+#define RLOG_AF_INET    4
+#define RLOG_AF_INET6   6
+
+struct yar_rlog_rec {
+    uint16_t reclen;        /* header, payload and padding */
+    uint8_t family;
+    uint8_t status;
+    uint16_t port;
+    uint16_t paylen;        /* the payload follows the header */
+    int32_t err;
+    uint32_t elapsed;       /* microseconds from dispatch to the outcome */
+    uint64_t ts;            /* dispatch time, microseconds since the epoch */
+    uint8_t addr[16];       /* network byte order, IPv4 in the first four */
+};
+
+#define RLOG_MAX_PAYLOAD (UINT16_MAX - sizeof(struct yar_rlog_rec) - 7)
+#define RLOG_PAYLOAD(rec) ((const unsigned char *)((rec) + 1))
+
+typedef struct yar_rlog yar_rlog_t;
+
+/**
+ * yar_rlog_new --
+ *     create a log writer that writes to out. Payloads longer than 
+ *     maxpayload bytes are truncated
+ *
+ * @return NULL on error
+ */
+yar_rlog_t *yar_rlog_new(yar_sink_t *out, size_t maxpayload);
+
+/**
+ * yar_rlog_free --
+ *     write the current block, if any, and free the writer. The sink is
+ *     not closed
+ *
+ * @return -1 on error, 0 on success
+ */
+int yar_rlog_free(yar_rlog_t *l);
+int yar_rlog_flush(yar_rlog_t *l);
+size_t yar_rlog_maxpayload(const yar_rlog_t *l);
+
+/* fill in the family, address and port of a record */
+void yar_rlog_rec_set_addr(struct yar_rlog_rec *rec, 
+        const struct sockaddr *sa);
+
+/**
+ * yar_rlog_reserve --
+ *     append a record with rec->paylen bytes of payload, which may be 
+ *     truncated, and return a pointer to where the payload is to be 
+ *     written. reclen is set by the writer. The pointer is valid until the
+ *     next call
+ *
+ * @return NULL on error
+ */
+void *yar_rlog_reserve(yar_rlog_t *l, const struct yar_rlog_rec *rec);
+int yar_rlog_append(yar_rlog_t *l, const struct yar_rlog_rec *rec, 
+        const void *payload);
+
+const char *yar_rlog_status_str(unsigned int status);
+
+typedef struct yar_rlog_reader yar_rlog_reader_t;
+
+/* records matching all of the criteria are returned */
+struct yar_rlog_filter {
+    uint32_t statuses;      /* (1 << status) bits, 0 for all */
+    uint64_t tsmin;
+    uint64_t tsmax;
+    uint16_t portmin;
+    uint16_t portmax;
+    uint32_t v4min;         /* restricting the IPv4 range excludes */
+    uint32_t v4max;         /* IPv6 records */
+};
+
+/* a filter that matches all records */
+void yar_rlog_filter_init(struct yar_rlog_filter *f);
+
+/**
+ * yar_rlog_reader_open --
+ *     map a log file for reading. A block that was not completely written
+ *     ends the log
+ *
+ * @return NULL on error
+ */
+yar_rlog_reader_t *yar_rlog_reader_open(const char *path);
+void yar_rlog_reader_close(yar_rlog_reader_t *r);
+
+/**
+ * yar_rlog_reader_next --
+ *     the next record matching f, which may be NULL. The record points 
+ *     into the mapped file
+ *
+ * @return NULL at the end of the log, or on a corrupt block with errno
+ *         set to EINVAL
+ */
+const struct yar_rlog_rec *yar_rlog_reader_next(yar_rlog_reader_t *r,
+        const struct yar_rlog_filter *f);
+
+#endif
@@ -0,0 +1,221 @@
+/*
+Copyright (c) 2013, Sebastian Cato
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <assert.h>
+
+#include "rtt.h"
+
+#define RTT_WAYS        4   /* entries per set */
+#define RTT_KEYLEN      16
+
+struct rtt_entry {
+    unsigned char key[RTT_KEYLEN];
+    int af;                 /* 0 for an unused entry */
+    uint32_t srtt;          /* microseconds */
+    uint32_t rttvar;
+    uint32_t nsamples;
+    uint32_t backoff;       /* the estimate is doubled this many times */
+    uint64_t used;          /* for replacement */
+};
+
+struct yar_rtt {
+    struct rtt_entry *entries;
+    size_t nsets;           /* a power of two */
+    unsigned int v4bits;
+    unsigned int v6bits;
+    uint64_t clock;
+};
+
+yar_rtt_t *yar_rtt_new(size_t nentries, unsigned int v4bits, 
+        unsigned int v6bits)
+{
+    yar_rtt_t *r;
+    size_t nsets = 1;
+
+    if (v4bits > 32 || v6bits > 128) {
+        return NULL;
+    }
+
+    while (nsets * RTT_WAYS < nentries) {
+        nsets <<= 1;
+    }
+
+    r = malloc(sizeof(*r));
+    if (r == NULL) {
+        return NULL;
+    }
+
+    r->entries = calloc(nsets * RTT_WAYS, sizeof(*r->entries));
+    if (r->entries == NULL) {
+        free(r);
+        return NULL;
+    }
+
+    r->nsets = nsets;
+    r->v4bits = v4bits;
+    r->v6bits = v6bits;
+    r->clock = 0;
+    return r;
+}
+
+void yar_rtt_free(yar_rtt_t *r)
+{
+    if (r != NULL) {
+        free(r->entries);
+        free(r);
+    }
+}
+
+/* the masked prefix of addr, and its hash */
+static uint32_t rtt_key(const yar_rtt_t *r, const yar_addr_t *addr,
+        unsigned char *key)
+{
+    const unsigned char *p;
+    unsigned int bits, i;
+    uint32_t h = 2166136261u; /* FNV-1a */
+
+    memset(key, 0, RTT_KEYLEN);
+    if (addr->af == AF_INET) {
+        p = (const unsigned char *)
+                &((const struct sockaddr_in *)&addr->saddr)->sin_addr;
+        bits = r->v4bits;
+    } else {
+        p = (const unsigned char *)
+                &((const struct sockaddr_in6 *)&addr->saddr)->sin6_addr;
+        bits = r->v6bits;
+    }
+
+    for (i = 0; i < bits / 8; i++) {
+        key[i] = p[i];
+    }
+
+    if (bits % 8 != 0) {
+        key[i] = p[i] & (unsigned char)(0xff << (8 - bits % 8));
+    }
+
+    for (i = 0; i < RTT_KEYLEN; i++) {
+        h = (h ^ key[i]) * 16777619u;
+    }
+
+    return h ^ (uint32_t)addr->af;
+}
+
+/**
+ * rtt_lookup --
+ *     find the entry of the prefix of addr. If there is none and create is 
+ *     set, the least recently used entry of its set is replaced
+ */
+static struct rtt_entry *rtt_lookup(yar_rtt_t *r, const yar_addr_t *addr,
+        int create)
+{
+    unsigned char key[RTT_KEYLEN];
+    struct rtt_entry *set, *victim;
+    size_t i;
+
+    set = r->entries + 
+            (rtt_key(r, addr, key) & (r->nsets - 1)) * RTT_WAYS;
+    victim = set;
+    for (i = 0; i < RTT_WAYS; i++) {
+        if (set[i].af == addr->af && 
+                memcmp(set[i].key, key, RTT_KEYLEN) == 0) {
+            set[i].used = ++r->clock;
+            return &set[i];
+        } else if (set[i].used < victim->used) {
+            victim = &set[i];
+        }
+    }
+
+    if (!create) {
+        return NULL;
+    }
+
+    memcpy(victim->key, key, RTT_KEYLEN);
+    victim->af = addr->af;
+    victim->nsamples = 0;
+    victim->backoff = 0;
+    victim->used = ++r->clock;
+    return victim;
+}
+
+void yar_rtt_sample(yar_rtt_t *r, const yar_addr_t *addr, unsigned int usec)
+{
+    struct rtt_entry *e;
+    uint32_t delta;
+
+    assert(r != NULL);
+    assert(addr != NULL);
+
+    e = rtt_lookup(r, addr, 1);
+    if (e->nsamples == 0) {
+        e->srtt = usec;
+        e->rttvar = usec / 2;
+    } else {
+        /* RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|, SRTT = 7/8 SRTT + 1/8 R */
+        delta = e->srtt > usec ? e->srtt - usec : usec - e->srtt;
+        e->rttvar = (uint32_t)(((uint64_t)e->rttvar * 3 + delta) / 4);
+        e->srtt = (uint32_t)(((uint64_t)e->srtt * 7 + usec) / 8);
+    }
+
+    if (e->nsamples < UINT32_MAX) {
+        e->nsamples++;
+    }
+
+    e->backoff = 0;
+}
+
+void yar_rtt_backoff(yar_rtt_t *r, const yar_addr_t *addr)
+{
+    struct rtt_entry *e;
+
+    assert(r != NULL);
+    assert(addr != NULL);
+
+    e = rtt_lookup(r, addr, 0);
+    if (e != NULL && e->nsamples >= RTT_MIN_SAMPLES && 
+            e->backoff < RTT_MAX_BACKOFF) {
+        e->backoff++;
+    }
+}
+
+unsigned int yar_rtt_timeout(yar_rtt_t *r, const yar_addr_t *addr)
+{
+    struct rtt_entry *e;
+    uint64_t rto;
+
+    assert(r != NULL);
+    assert(addr != NULL);
+
+    e = rtt_lookup(r, addr, 0);
+    if (e == NULL || e->nsamples < RTT_MIN_SAMPLES) {
+        return 0;
+    }
+
+    rto = ((uint64_t)e->srtt + 4 * (uint64_t)e->rttvar) << e->backoff;
+    return rto > UINT_MAX ? UINT_MAX : (unsigned int)rto;
+}
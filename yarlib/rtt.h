@@ -0,0 +1,76 @@
+/*
+Copyright (c) 2013, Sebastian Cato
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef __RTT_H
+#define __RTT_H
+
+#include <stddef.h>
+
+#include "addr.h"
+
+/**
+ * Round-trip time estimator. Connect times are sampled per destination 
+ * prefix, and a smoothed RTT and RTT variance are kept for each prefix like
+ * TCP does for a connection (RFC 6298), in a bounded, set-associative 
+ * table where the least recently used prefix of a set is replaced. The 
+ * estimate for a prefix, SRTT + 4 * RTTVAR, is used as the connect 
+ * timeout of new endpoints in that prefix, see cli->rtt. It is doubled for
+ * every timeout until the next sample, like TCP backs off its RTO.
+ */
+
+typedef struct yar_rtt yar_rtt_t;
+
+/* prefixes need this many samples before they have an estimate */
+#define RTT_MIN_SAMPLES 3
+
+/* the most times an estimate is doubled */
+#define RTT_MAX_BACKOFF 6
+
+/**
+ * yar_rtt_new --
+ *     create an estimator for about nentries prefixes, of v4bits for IPv4
+ *     addresses and v6bits for IPv6 addresses
+ *
+ * @return NULL on error
+ */
+yar_rtt_t *yar_rtt_new(size_t nentries, unsigned int v4bits, 
+        unsigned int v6bits);
+void yar_rtt_free(yar_rtt_t *r);
+
+/* add an RTT sample, in microseconds, for the prefix of addr */
+void yar_rtt_sample(yar_rtt_t *r, const yar_addr_t *addr, unsigned int usec);
+
+/* a connection in the prefix of addr timed out on the estimate, back off */
+void yar_rtt_backoff(yar_rtt_t *r, const yar_addr_t *addr);
+
+/**
+ * yar_rtt_timeout --
+ *     the retransmission timeout estimate of the prefix of addr, in 
+ *     microseconds
+ *
+ * @return 0 if the prefix has no estimate
+ */
+unsigned int yar_rtt_timeout(yar_rtt_t *r, const yar_addr_t *addr);
+
+#endif
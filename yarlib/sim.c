@@ -0,0 +1,444 @@
+/*
+Copyright (c) 2013, Sebastian Cato
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <netinet/in.h>
+
+#include "sim.h"
+
+#define SIM_INITIAL_HEAP 1024
+#define SIM_NQUEUES      16
+
+/* a FIFO of timers with the same delay. Its proxy timer is in the heap in
+   place of the head of the queue */
+struct sim_queue {
+    yar_sim_t *sim;
+    uint64_t delay;
+    struct yar_sim_timer *head, **tail;
+    struct yar_sim_timer proxy;
+};
+
+struct sim_heapent {
+    uint64_t when;
+    uint64_t seq;
+    struct yar_sim_timer *t;
+};
+
+struct yar_sim {
+    struct yar_sim_params params;
+    uint64_t now;
+    uint64_t seq;
+    struct sim_heapent *heap;
+    size_t nheap;
+    size_t heapcap;
+    struct sim_queue queues[SIM_NQUEUES];
+    size_t nqueues;
+};
+
+yar_sim_t *yar_sim_new(const struct yar_sim_params *params)
+{
+    yar_sim_t *sim;
+
+    assert(params != NULL);
+
+    if (params->rtt_min > params->rtt_max || 
+            params->resp_min > params->resp_max ||
+            params->refuse_ppm + params->loss_ppm > 1000000) {
+        return NULL;
+    }
+
+    sim = calloc(1, sizeof(*sim));
+    if (sim == NULL) {
+        return NULL;
+    }
+
+    sim->params = *params;
+    return sim;
+}
+
+void yar_sim_free(yar_sim_t *sim)
+{
+    if (sim != NULL) {
+        free(sim->heap);
+        free(sim);
+    }
+}
+
+static uint64_t splitmix64(uint64_t *state)
+{
+    uint64_t z;
+
+    z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/* a uniformly distributed value in [lo, hi] */
+static uint32_t sim_uniform(uint64_t *state, uint32_t lo, uint32_t hi)
+{
+    return lo + (uint32_t)(splitmix64(state) % ((uint64_t)hi - lo + 1));
+}
+
+void yar_sim_target(const yar_sim_t *sim, const yar_addr_t *addr, 
+        yar_port_t port, struct yar_sim_target *target)
+{
+    const struct yar_sim_params *p;
+    const unsigned char *a;
+    uint64_t state;
+    uint32_t draw;
+    size_t i, len;
+
+    assert(sim != NULL);
+    assert(addr != NULL);
+    assert(target != NULL);
+
+    p = &sim->params;
+    if (addr->af == AF_INET) {
+        a = (const unsigned char *)
+                &((const struct sockaddr_in *)&addr->saddr)->sin_addr;
+        len = 4;
+    } else {
+        a = (const unsigned char *)
+                &((const struct sockaddr_in6 *)&addr->saddr)->sin6_addr;
+        len = 16;
+    }
+
+    state = p->seed ^ ((uint64_t)port << 48);
+    for (i = 0; i < len; i++) {
+        state = (state << 8 | state >> 56) ^ a[i];
+        if (i % 8 == 7) {
+            splitmix64(&state);
+        }
+    }
+
+    splitmix64(&state);
+    draw = sim_uniform(&state, 0, 999999);
+    if (draw < p->refuse_ppm) {
+        target->outcome = SIM_REFUSE;
+    } else if (draw < p->refuse_ppm + p->loss_ppm) {
+        target->outcome = SIM_DROP;
+    } else {
+        target->outcome = SIM_ACCEPT;
+    }
+
+    target->rtt_us = sim_uniform(&state, p->rtt_min, p->rtt_max);
+    if (p->tail_ppm > 0 && sim_uniform(&state, 0, 999999) < p->tail_ppm &&
+            p->tail_factor > 1) {
+        target->rtt_us = target->rtt_us > UINT32_MAX / p->tail_factor ?
+                UINT32_MAX : target->rtt_us * p->tail_factor;
+    }
+
+    target->resp_len = sim_uniform(&state, p->resp_min, p->resp_max);
+}
+
+uint64_t yar_sim_now(const yar_sim_t *sim)
+{
+    return sim->now;
+}
+
+unsigned int yar_sim_flags(const yar_sim_t *sim)
+{
+    return sim->params.flags;
+}
+
+/* timers are kept in a binary min-heap on (when, seq). The keys are 
+   copied into the heap, so that comparisons stay within it */
+static int ent_before(const struct sim_heapent *a, 
+        const struct sim_heapent *b)
+{
+    return a->when < b->when || (a->when == b->when && a->seq < b->seq);
+}
+
+static void heap_set(yar_sim_t *sim, size_t i, const struct sim_heapent *e)
+{
+    sim->heap[i] = *e;
+    e->t->idx = i;
+}
+
+static void heap_up(yar_sim_t *sim, size_t i)
+{
+    struct sim_heapent e = sim->heap[i];
+    size_t parent;
+
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (!ent_before(&e, &sim->heap[parent])) {
+            break;
+        }
+
+        heap_set(sim, i, &sim->heap[parent]);
+        i = parent;
+    }
+
+    heap_set(sim, i, &e);
+}
+
+static void heap_down(yar_sim_t *sim, size_t i)
+{
+    struct sim_heapent e = sim->heap[i];
+    size_t child;
+
+    for (;;) {
+        child = 2 * i + 1;
+        if (child >= sim->nheap) {
+            break;
+        }
+
+        if (child + 1 < sim->nheap && 
+                ent_before(&sim->heap[child + 1], &sim->heap[child])) {
+            child++;
+        }
+
+        if (!ent_before(&sim->heap[child], &e)) {
+            break;
+        }
+
+        heap_set(sim, i, &sim->heap[child]);
+        i = child;
+    }
+
+    heap_set(sim, i, &e);
+}
+
+void yar_sim_timer_init(struct yar_sim_timer *t, void (*cb)(void *arg), 
+        void *arg)
+{
+    assert(t != NULL);
+    assert(cb != NULL);
+
+    t->when = 0;
+    t->seq = 0;
+    t->idx = SIZE_MAX;
+    t->queue = NULL;
+    t->qnext = NULL;
+    t->qprev = NULL;
+    t->cb = cb;
+    t->arg = arg;
+}
+
+int yar_sim_timer_pending(const struct yar_sim_timer *t)
+{
+    return t->idx != SIZE_MAX || t->queue != NULL;
+}
+
+/* make room for one more timer in the heap */
+static int heap_reserve(yar_sim_t *sim)
+{
+    struct sim_heapent *heap;
+    size_t cap;
+
+    if (sim->nheap < sim->heapcap) {
+        return 0;
+    }
+
+    cap = sim->heapcap > 0 ? sim->heapcap * 2 : SIM_INITIAL_HEAP;
+    heap = realloc(sim->heap, cap * sizeof(*heap));
+    if (heap == NULL) {
+        return -1;
+    }
+
+    sim->heap = heap;
+    sim->heapcap = cap;
+    return 0;
+}
+
+static void heap_insert(yar_sim_t *sim, struct yar_sim_timer *t)
+{
+    assert(sim->nheap < sim->heapcap);
+
+    sim->heap[sim->nheap].when = t->when;
+    sim->heap[sim->nheap].seq = t->seq;
+    sim->heap[sim->nheap].t = t;
+    heap_up(sim, sim->nheap++);
+}
+
+static void heap_remove(yar_sim_t *sim, struct yar_sim_timer *t)
+{
+    size_t i;
+
+    if (t->idx == SIZE_MAX) {
+        return;
+    }
+
+    i = t->idx;
+    t->idx = SIZE_MAX;
+    if (i == --sim->nheap) {
+        return;
+    }
+
+    /* move the last timer into the hole */
+    heap_set(sim, i, &sim->heap[sim->nheap]);
+    if (i > 0 && ent_before(&sim->heap[i], &sim->heap[(i - 1) / 2])) {
+        heap_up(sim, i);
+    } else {
+        heap_down(sim, i);
+    }
+}
+
+/* let the proxy of a queue stand in for its current head */
+static void queue_sync(yar_sim_t *sim, struct sim_queue *q)
+{
+    heap_remove(sim, &q->proxy);
+    if (q->head != NULL) {
+        q->proxy.when = q->head->when;
+        q->proxy.seq = q->head->seq;
+        heap_insert(sim, &q->proxy);
+    }
+}
+
+/* the head of a queue is due */
+static void queue_fire(void *arg)
+{
+    struct sim_queue *q = arg;
+    struct yar_sim_timer *t = q->head;
+
+    yar_sim_timer_del(q->sim, t);
+    t->cb(t->arg);
+}
+
+static struct sim_queue *queue_get(yar_sim_t *sim, uint64_t delay)
+{
+    struct sim_queue *q;
+    size_t i;
+
+    for (i = 0; i < sim->nqueues; i++) {
+        if (sim->queues[i].delay == delay) {
+            return &sim->queues[i];
+        }
+    }
+
+    if (sim->nqueues == SIM_NQUEUES) {
+        return NULL;
+    }
+
+    q = &sim->queues[sim->nqueues++];
+    q->sim = sim;
+    q->delay = delay;
+    q->head = NULL;
+    q->tail = &q->head;
+    yar_sim_timer_init(&q->proxy, queue_fire, q);
+    return q;
+}
+
+int yar_sim_timer_add(yar_sim_t *sim, struct yar_sim_timer *t, 
+        uint64_t delay)
+{
+    assert(sim != NULL);
+    assert(t != NULL);
+
+    yar_sim_timer_del(sim, t);
+    if (heap_reserve(sim) < 0) {
+        return -1;
+    }
+
+    t->when = sim->now + delay;
+    t->seq = sim->seq++;
+    heap_insert(sim, t);
+    return 0;
+}
+
+int yar_sim_timer_add_common(yar_sim_t *sim, struct yar_sim_timer *t, 
+        uint64_t delay)
+{
+    struct sim_queue *q;
+
+    assert(sim != NULL);
+    assert(t != NULL);
+
+    yar_sim_timer_del(sim, t);
+    q = queue_get(sim, delay);
+    if (q == NULL) {
+        return yar_sim_timer_add(sim, t, delay);
+    } else if (q->head == NULL && heap_reserve(sim) < 0) {
+        return -1;
+    }
+
+    t->when = sim->now + delay;
+    t->seq = sim->seq++;
+    t->queue = q;
+    t->qnext = NULL;
+    t->qprev = q->tail;
+    *q->tail = t;
+    q->tail = &t->qnext;
+    if (q->head == t) {
+        queue_sync(sim, q);
+    }
+
+    return 0;
+}
+
+void yar_sim_timer_del(yar_sim_t *sim, struct yar_sim_timer *t)
+{
+    struct sim_queue *q;
+    int head;
+
+    assert(sim != NULL);
+    assert(t != NULL);
+
+    if (t->queue == NULL) {
+        heap_remove(sim, t);
+        return;
+    }
+
+    q = t->queue;
+    head = q->head == t;
+    *t->qprev = t->qnext;
+    if (t->qnext != NULL) {
+        t->qnext->qprev = t->qprev;
+    } else {
+        q->tail = t->qprev;
+    }
+
+    t->queue = NULL;
+    t->qnext = NULL;
+    t->qprev = NULL;
+    if (head) {
+        queue_sync(sim, q);
+    }
+}
+
+int yar_sim_run_once(yar_sim_t *sim)
+{
+    struct yar_sim_timer *t;
+
+    assert(sim != NULL);
+
+    if (sim->nheap == 0) {
+        return 0;
+    }
+
+    t = sim->heap[0].t;
+    heap_remove(sim, t);
+    if (t->when > sim->now) {
+        sim->now = t->when;
+    }
+
+    t->cb(t->arg);
+    return 1;
+}
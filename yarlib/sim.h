@@ -0,0 +1,148 @@
+/*
+Copyright (c) 2013, Sebastian Cato
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef __SIM_H
+#define __SIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "addr.h"
+#include "port.h"
+
+/**
+ * Simulated network. Targets are modelled in-process instead of being 
+ * connected to, and time is virtual: it jumps to the next pending timer,
+ * so a scan runs as fast as the library can process it, and the same 
+ * parameters always give the same run. The fate of each target is a 
+ * function of its address, port and the seed alone, independent of the
+ * order targets are dispatched in. See yar_set_sim.
+ */
+
+typedef struct yar_sim yar_sim_t;
+
+/* server behavior flags */
+#define SIM_FLG_BANNER  1 /* respond on connect instead of to a request */
+#define SIM_FLG_CLOSE   2 /* close after responding */
+
+struct yar_sim_params {
+    uint64_t seed;
+
+    /* round trip times in microseconds, uniformly distributed. A share of 
+       targets, tail_ppm per million, has its RTT multiplied by 
+       tail_factor */
+    unsigned int rtt_min;
+    unsigned int rtt_max;
+    unsigned int tail_ppm;
+    unsigned int tail_factor;
+
+    /* shares of targets, per million, that refuse connections and that 
+       drop them so the connection attempt times out. The rest accept */
+    unsigned int refuse_ppm;
+    unsigned int loss_ppm;
+
+    /* response sizes in bytes, uniformly distributed. Responses end with 
+       an empty line. 0 for no response */
+    unsigned int resp_min;
+    unsigned int resp_max;
+
+    unsigned int flags;
+};
+
+/* outcomes of connection attempts */
+#define SIM_ACCEPT      0
+#define SIM_REFUSE      1
+#define SIM_DROP        2
+
+struct yar_sim_target {
+    unsigned int outcome;
+    uint32_t rtt_us;
+    uint32_t resp_len;
+};
+
+/**
+ * Virtual timers. A timer is owned by the caller, and is pending from 
+ * yar_sim_timer_add until it fires or is deleted. Timers that are due at
+ * the same time fire in the order they were added.
+ */
+struct yar_sim_timer {
+    uint64_t when;      /* virtual nanoseconds */
+    uint64_t seq;
+    size_t idx;         /* heap position, SIZE_MAX when not in the heap */
+    void *queue;        /* set for timers added by yar_sim_timer_add_common */
+    struct yar_sim_timer *qnext, **qprev;
+    void (*cb)(void *arg);
+    void *arg;
+};
+
+yar_sim_t *yar_sim_new(const struct yar_sim_params *params);
+void yar_sim_free(yar_sim_t *sim);
+
+/* the fate of a target */
+void yar_sim_target(const yar_sim_t *sim, const yar_addr_t *addr, 
+        yar_port_t port, struct yar_sim_target *target);
+
+/* the virtual clock, in nanoseconds */
+uint64_t yar_sim_now(const yar_sim_t *sim);
+
+/* the SIM_FLG_* flags of the simulated servers */
+unsigned int yar_sim_flags(const yar_sim_t *sim);
+
+void yar_sim_timer_init(struct yar_sim_timer *t, void (*cb)(void *arg), 
+        void *arg);
+
+/**
+ * yar_sim_timer_add --
+ *     fire a timer delay nanoseconds from now, rescheduling it if it is
+ *     pending
+ *
+ * @return -1 on error, 0 on success
+ */
+int yar_sim_timer_add(yar_sim_t *sim, struct yar_sim_timer *t, 
+        uint64_t delay);
+
+/**
+ * yar_sim_timer_add_common --
+ *     like yar_sim_timer_add, for delays that are shared by many timers, 
+ *     such as timeouts. Timers with the same delay fire in the order they
+ *     were added, so they are queued in FIFO order instead of in the 
+ *     heap, and adding and deleting them takes constant time. The number
+ *     of such delays is limited, timers with other delays go in the heap
+ *
+ * @return -1 on error, 0 on success
+ */
+int yar_sim_timer_add_common(yar_sim_t *sim, struct yar_sim_timer *t, 
+        uint64_t delay);
+void yar_sim_timer_del(yar_sim_t *sim, struct yar_sim_timer *t);
+int yar_sim_timer_pending(const struct yar_sim_timer *t);
+
+/**
+ * yar_sim_run_once --
+ *     advance the clock to the next pending timer, and fire it
+ *
+ * @return 0 if no timer is pending, 1 otherwise
+ */
+int yar_sim_run_once(yar_sim_t *sim);
+
+#endif
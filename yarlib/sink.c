@@ -0,0 +1,396 @@
+/*
+Copyright (c) 2013, Sebastian Cato
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <assert.h>
+
+#include "sink.h"
+
+#define SINK_DEFAULT_SIZE   (1 << 20)
+#define SINK_MIN_SIZE       4096
+#define SINK_FLUSH_MS       10  /* longest time a record waits in the ring */
+#define SINK_LINEBUF        512
+#define SINK_CACHELINE      64
+
+struct yar_sink {
+    int fd;
+    unsigned char *ring;
+    size_t size;        /* a power of two */
+    size_t batch;       /* wake the writer when this much is buffered */
+
+    /* head and tail increase monotonically and are masked on access. 
+       They are written by one thread each, on separate cache lines */
+    _Alignas(SINK_CACHELINE) atomic_size_t head;
+    size_t tailcache;   /* the last tail seen by the producer */
+    unsigned char *overflow;
+    size_t overflowoff;
+    size_t noverflow;
+    size_t overflowcap;
+
+    _Alignas(SINK_CACHELINE) atomic_size_t tail;
+    atomic_int sleeping;
+    atomic_int stop;
+    int err;            /* errno of the first failed write */
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+static int yar_sink_writev(int fd, struct iovec *iov, int iovcnt)
+{
+    ssize_t ret;
+    size_t n;
+
+    while (iovcnt > 0) {
+        ret = writev(fd, iov, iovcnt);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return -1;
+        }
+
+        for (n = (size_t)ret; iovcnt > 0 && n >= iov->iov_len; iovcnt--) {
+            n -= iov->iov_len;
+            iov++;
+        }
+
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    return 0;
+}
+
+/* write avail bytes starting at tail, in two parts if they wrap */
+static void yar_sink_flush(yar_sink_t *s, size_t tail, size_t avail)
+{
+    struct iovec iov[2];
+    size_t off, first;
+    int iovcnt = 1;
+
+    off = tail & (s->size - 1);
+    first = s->size - off < avail ? s->size - off : avail;
+    iov[0].iov_base = s->ring + off;
+    iov[0].iov_len = first;
+    if (first < avail) {
+        iov[1].iov_base = s->ring;
+        iov[1].iov_len = avail - first;
+        iovcnt = 2;
+    }
+
+    /* records are dropped after a failed write, so that the producer is
+       never stuck on a broken fd */
+    if (s->err == 0 && yar_sink_writev(s->fd, iov, iovcnt) < 0) {
+        s->err = errno;
+    }
+}
+
+static void *yar_sink_writer(void *data)
+{
+    yar_sink_t *s = data;
+    struct timespec ts;
+    size_t head, tail, avail;
+    int waited = 0;
+
+    tail = atomic_load_explicit(&s->tail, memory_order_relaxed);
+    for (;;) {
+        head = atomic_load_explicit(&s->head, memory_order_acquire);
+        avail = head - tail;
+        if (avail > 0 && (avail >= s->batch || waited || 
+                atomic_load(&s->stop))) {
+            yar_sink_flush(s, tail, avail);
+            tail += avail;
+            atomic_store_explicit(&s->tail, tail, memory_order_release);
+            waited = 0;
+            continue;
+        } else if (avail == 0 && atomic_load(&s->stop)) {
+            break;
+        }
+
+        /* the producer signals without the lock, so a wakeup can be 
+           missed. The timeout bounds the delay */
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += SINK_FLUSH_MS * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+
+        pthread_mutex_lock(&s->lock);
+        atomic_store(&s->sleeping, 1);
+        if (!atomic_load(&s->stop) && 
+                atomic_load_explicit(&s->head, memory_order_acquire) == head) {
+            pthread_cond_timedwait(&s->cond, &s->lock, &ts);
+        }
+
+        atomic_store(&s->sleeping, 0);
+        pthread_mutex_unlock(&s->lock);
+        waited = 1;
+    }
+
+    return NULL;
+}
+
+yar_sink_t *yar_sink_new(int fd, size_t ringsize)
+{
+    yar_sink_t *s;
+    size_t size;
+
+    if (ringsize == 0) {
+        ringsize = SINK_DEFAULT_SIZE;
+    }
+
+    for (size = SINK_MIN_SIZE; size < ringsize; size <<= 1) {
+        if (size > ((size_t)-1 >> 1)) {
+            errno = EINVAL;
+            return NULL;
+        }
+    }
+
+    /* for the alignment of head and tail */
+    if ((errno = posix_memalign((void **)&s, SINK_CACHELINE, 
+            sizeof(yar_sink_t))) != 0) {
+        return NULL;
+    }
+
+    memset(s, 0, sizeof(yar_sink_t));
+    s->ring = malloc(size);
+    if (s->ring == NULL) {
+        free(s);
+        return NULL;
+    }
+
+    s->fd = fd;
+    s->size = size;
+    s->batch = size / 4;
+    atomic_init(&s->head, 0);
+    atomic_init(&s->tail, 0);
+    atomic_init(&s->sleeping, 0);
+    atomic_init(&s->stop, 0);
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+    if ((errno = pthread_create(&s->thread, NULL, yar_sink_writer, s)) != 0) {
+        pthread_cond_destroy(&s->cond);
+        pthread_mutex_destroy(&s->lock);
+        free(s->ring);
+        free(s);
+        return NULL;
+    }
+
+    return s;
+}
+
+/* copy as much as fits into the ring, returns the number of bytes */
+static size_t yar_sink_put(yar_sink_t *s, const void *data, size_t len)
+{
+    size_t head, space, off, first;
+
+    head = atomic_load_explicit(&s->head, memory_order_relaxed);
+    space = s->size - (head - s->tailcache);
+    if (space < len) {
+        s->tailcache = atomic_load_explicit(&s->tail, memory_order_acquire);
+        space = s->size - (head - s->tailcache);
+    }
+
+    if (len > space) {
+        len = space;
+    }
+
+    if (len == 0) {
+        return 0;
+    }
+
+    off = head & (s->size - 1);
+    first = s->size - off < len ? s->size - off : len;
+    memcpy(s->ring + off, data, first);
+    memcpy(s->ring, (const unsigned char *)data + first, len - first);
+    atomic_store_explicit(&s->head, head + len, memory_order_release);
+    if (head + len - s->tailcache >= s->batch && atomic_load(&s->sleeping)) {
+        pthread_cond_signal(&s->cond);
+    }
+
+    return len;
+}
+
+static void yar_sink_drain_overflow(yar_sink_t *s)
+{
+    size_t n;
+
+    n = yar_sink_put(s, s->overflow + s->overflowoff, s->noverflow);
+    s->overflowoff += n;
+    s->noverflow -= n;
+    if (s->noverflow == 0) {
+        s->overflowoff = 0;
+    }
+}
+
+static int yar_sink_overflow(yar_sink_t *s, const void *data, size_t len)
+{
+    unsigned char *tmp;
+    size_t cap;
+
+    if (s->overflowoff > 0) {
+        memmove(s->overflow, s->overflow + s->overflowoff, s->noverflow);
+        s->overflowoff = 0;
+    }
+
+    if (s->noverflow + len > s->overflowcap) {
+        for (cap = s->overflowcap == 0 ? SINK_MIN_SIZE : s->overflowcap;
+                cap < s->noverflow + len; cap <<= 1);
+        tmp = realloc(s->overflow, cap);
+        if (tmp == NULL) {
+            return -1;
+        }
+
+        s->overflow = tmp;
+        s->overflowcap = cap;
+    }
+
+    memcpy(s->overflow + s->noverflow, data, len);
+    s->noverflow += len;
+    return 0;
+}
+
+int yar_sink_write(yar_sink_t *s, const void *data, size_t len)
+{
+    size_t n = 0;
+
+    assert(s != NULL);
+    assert(data != NULL || len == 0);
+
+    if (s->noverflow > 0) {
+        yar_sink_drain_overflow(s);
+    }
+
+    /* keep the records in order */
+    if (s->noverflow == 0) {
+        n = yar_sink_put(s, data, len);
+    }
+
+    if (n < len) {
+        return yar_sink_overflow(s, (const unsigned char *)data + n, len - n);
+    }
+
+    return 0;
+}
+
+int yar_sink_printf(yar_sink_t *s, const char *fmt, ...)
+{
+    char buf[SINK_LINEBUF], *str = buf;
+    va_list ap;
+    int len, ret;
+
+    va_start(ap, fmt);
+    len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (len < 0) {
+        return -1;
+    } else if ((size_t)len >= sizeof(buf)) {
+        str = malloc((size_t)len + 1);
+        if (str == NULL) {
+            return -1;
+        }
+
+        va_start(ap, fmt);
+        vsnprintf(str, (size_t)len + 1, fmt, ap);
+        va_end(ap);
+    }
+
+    ret = yar_sink_write(s, str, (size_t)len);
+    if (str != buf) {
+        free(str);
+    }
+
+    return ret;
+}
+
+int yar_sink_congested(yar_sink_t *s)
+{
+    size_t used;
+
+    assert(s != NULL);
+
+    if (s->noverflow > 0) {
+        yar_sink_drain_overflow(s);
+        if (s->noverflow > 0) {
+            return 1;
+        }
+    }
+
+    used = atomic_load_explicit(&s->head, memory_order_relaxed) -
+            atomic_load_explicit(&s->tail, memory_order_relaxed);
+    return used > s->size / 4 * 3;
+}
+
+int yar_sink_close(yar_sink_t *s)
+{
+    struct iovec iov;
+    int err;
+
+    if (s == NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    atomic_store(&s->stop, 1);
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->thread, NULL);
+
+    /* the writer is gone, so what remains can be written directly */
+    if (s->noverflow > 0 && s->err == 0) {
+        iov.iov_base = s->overflow + s->overflowoff;
+        iov.iov_len = s->noverflow;
+        if (yar_sink_writev(s->fd, &iov, 1) < 0) {
+            s->err = errno;
+        }
+    }
+
+    err = s->err;
+    pthread_cond_destroy(&s->cond);
+    pthread_mutex_destroy(&s->lock);
+    free(s->overflow);
+    free(s->ring);
+    free(s);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
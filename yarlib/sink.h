@@ -0,0 +1,80 @@
+/*
+Copyright (c) 2013, Sebastian Cato
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef __SINK_H
+#define __SINK_H
+
+#include <stddef.h>
+
+/**
+ * Result sink. Records are appended from event callbacks to a lock-free 
+ * single-producer, single-consumer ring buffer without blocking, and a 
+ * writer thread writes them to a file descriptor in batches. Records that
+ * do not fit in the ring are kept in an overflow buffer until there is 
+ * room, and the sink reports itself as congested until then, so that a
+ * slow consumer holds back new connections instead of the event loop.
+ *
+ * All functions but yar_sink_new must be called from the thread that 
+ * runs the event loop.
+ */
+
+typedef struct yar_sink yar_sink_t;
+
+/**
+ * yar_sink_new --
+ *     start a writer thread for fd. ringsize is rounded up to a power of 
+ *     two, 0 selects the default size. fd is not closed by the sink
+ *
+ * @return NULL on error
+ */
+yar_sink_t *yar_sink_new(int fd, size_t ringsize);
+
+/**
+ * yar_sink_close --
+ *     write all remaining records, stop the writer thread and free the 
+ *     sink
+ *
+ * @return -1 if any write failed, with errno set, 0 otherwise
+ */
+int yar_sink_close(yar_sink_t *s);
+
+/**
+ * yar_sink_write --
+ *     append a record. Never blocks
+ *
+ * @return -1 on error, 0 on success
+ */
+int yar_sink_write(yar_sink_t *s, const void *data, size_t len);
+int yar_sink_printf(yar_sink_t *s, const char *fmt, ...)
+        __attribute__((format(printf, 2, 3)));
+
+/**
+ * yar_sink_congested --
+ *     move overflowed records to the ring if there is room, and tell 
+ *     whether the ring is more than three quarters full or records are 
+ *     still waiting in the overflow buffer
+ */
+int yar_sink_congested(yar_sink_t *s);
+
+#endif
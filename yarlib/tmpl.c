@@ -0,0 +1,390 @@
+/*
+Copyright (c) 2013, Sebastian Cato
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <assert.h>
+
+#include "tmpl.h"
+
+#define TMPL_LITERAL    0
+#define TMPL_ADDR       1
+#define TMPL_PORT       2
+#define TMPL_ADDRPORT   3
+#define TMPL_NONCE      4
+
+#define TMPL_PORT_MAXLEN    5
+#define TMPL_ADDR_MAXLEN    (ADDR_STRLEN - 1)
+#define TMPL_NONCE_LEN      16
+
+static const struct {
+    const char *name;
+    int type;
+    size_t maxlen;
+} _placeholders[] = {
+    {"addr", TMPL_ADDR, TMPL_ADDR_MAXLEN},
+    {"port", TMPL_PORT, TMPL_PORT_MAXLEN},
+    {"addrport", TMPL_ADDRPORT, TMPL_ADDR_MAXLEN + 3 + TMPL_PORT_MAXLEN},
+    {"nonce", TMPL_NONCE, TMPL_NONCE_LEN},
+};
+
+#define NPLACEHOLDERS (sizeof(_placeholders) / sizeof(*_placeholders))
+
+/* two decimal digits for each value below 100 */
+static const char _digits2[] = 
+        "00010203040506070809101112131415161718192021222324"
+        "25262728293031323334353637383940414243444546474849"
+        "50515253545556575859606162636465666768697071727374"
+        "75767778798081828384858687888990919293949596979899";
+
+static uint64_t _nonce_state = 0;
+
+struct tmpl_seg {
+    int type;
+    size_t off;     /* literal segments: offset in lit */
+    size_t len;
+};
+
+struct yar_tmpl {
+    struct tmpl_seg *segs;
+    size_t nsegs;
+    char *lit;
+    size_t maxlen;
+};
+
+static void tmpl_add_seg(yar_tmpl_t *t, int type, size_t off, size_t len)
+{
+    struct tmpl_seg *seg;
+
+    if (type == TMPL_LITERAL && t->nsegs > 0 && 
+            t->segs[t->nsegs-1].type == TMPL_LITERAL) {
+        t->segs[t->nsegs-1].len += len;
+        return;
+    }
+
+    seg = &t->segs[t->nsegs++];
+    seg->type = type;
+    seg->off = off;
+    seg->len = len;
+}
+
+yar_tmpl_t *yar_tmpl_new(const char *tmpl, size_t len)
+{
+    yar_tmpl_t *t;
+    const char *end;
+    size_t i, j, nlit = 0, namelen;
+
+    assert(tmpl != NULL);
+
+    t = calloc(1, sizeof(yar_tmpl_t));
+    if (t == NULL) {
+        return NULL;
+    }
+
+    /* a template of n bytes has at most n segments */
+    t->segs = malloc((len > 0 ? len : 1) * sizeof(*t->segs));
+    t->lit = malloc(len > 0 ? len : 1);
+    if (t->segs == NULL || t->lit == NULL) {
+        yar_tmpl_free(t);
+        return NULL;
+    }
+
+    for (i = 0; i < len; i++) {
+        if (tmpl[i] != '$' || i + 1 == len || 
+                (tmpl[i+1] != '$' && tmpl[i+1] != '{')) {
+            t->lit[nlit] = tmpl[i];
+            tmpl_add_seg(t, TMPL_LITERAL, nlit++, 1);
+            continue;
+        } else if (tmpl[i+1] == '$') {
+            t->lit[nlit] = '$';
+            tmpl_add_seg(t, TMPL_LITERAL, nlit++, 1);
+            i++;
+            continue;
+        }
+
+        end = memchr(tmpl + i + 2, '}', len - i - 2);
+        if (end == NULL) {
+            yar_tmpl_free(t);
+            errno = EINVAL;
+            return NULL;
+        }
+
+        namelen = (size_t)(end - (tmpl + i + 2));
+        for (j = 0; j < NPLACEHOLDERS; j++) {
+            if (strlen(_placeholders[j].name) == namelen && 
+                    memcmp(_placeholders[j].name, tmpl + i + 2, 
+                    namelen) == 0) {
+                break;
+            }
+        }
+
+        if (j == NPLACEHOLDERS) {
+            yar_tmpl_free(t);
+            errno = EINVAL;
+            return NULL;
+        }
+
+        tmpl_add_seg(t, _placeholders[j].type, 0, 0);
+        t->maxlen += _placeholders[j].maxlen;
+        i += namelen + 2;
+    }
+
+    t->maxlen += nlit;
+    return t;
+}
+
+void yar_tmpl_free(yar_tmpl_t *t)
+{
+    if (t != NULL) {
+        free(t->segs);
+        free(t->lit);
+        free(t);
+    }
+}
+
+size_t yar_tmpl_maxlen(const yar_tmpl_t *t)
+{
+    assert(t != NULL);
+    return t->maxlen;
+}
+
+static size_t tmpl_fmt_uint(char *dst, unsigned int val)
+{
+    char buf[10];
+    size_t n = sizeof(buf), r;
+
+    while (val >= 100) {
+        r = (val % 100) * 2;
+        val /= 100;
+        buf[--n] = _digits2[r + 1];
+        buf[--n] = _digits2[r];
+    }
+
+    if (val >= 10) {
+        buf[--n] = _digits2[val * 2 + 1];
+        buf[--n] = _digits2[val * 2];
+    } else {
+        buf[--n] = (char)('0' + val);
+    }
+
+    memcpy(dst, buf + n, sizeof(buf) - n);
+    return sizeof(buf) - n;
+}
+
+static size_t tmpl_fmt_ipv4(char *dst, const unsigned char *octets)
+{
+    size_t i, n = 0;
+
+    for (i = 0; i < 4; i++) {
+        if (i > 0) {
+            dst[n++] = '.';
+        }
+
+        n += tmpl_fmt_uint(dst + n, octets[i]);
+    }
+
+    return n;
+}
+
+static size_t tmpl_fmt_hex16(char *dst, unsigned int val)
+{
+    static const char hex[] = "0123456789abcdef";
+    size_t n = 0;
+    int shift;
+
+    for (shift = 12; shift > 0 && (val >> shift) == 0; shift -= 4);
+    for (; shift >= 0; shift -= 4) {
+        dst[n++] = hex[(val >> shift) & 0xf];
+    }
+
+    return n;
+}
+
+/**
+ * tmpl_fmt_ipv6 --
+ *     format an IPv6 address like inet_ntop does: the longest run of two or
+ *     more zero groups, the first one on ties, is compressed to "::", and 
+ *     IPv4-mapped and IPv4-compatible addresses end in dotted decimal. The
+ *     zone is appended for scoped addresses, like getnameinfo does
+ */
+static size_t tmpl_fmt_ipv6(char *dst, const struct sockaddr_in6 *sin6)
+{
+    const unsigned char *b = sin6->sin6_addr.s6_addr;
+    unsigned int words[8];
+    int i, best = -1, bestlen = 0, cur = -1, curlen = 0;
+    char ifname[IF_NAMESIZE];
+    size_t n = 0, len;
+
+    for (i = 0; i < 8; i++) {
+        words[i] = (unsigned int)b[2 * i] << 8 | b[2 * i + 1];
+        if (words[i] == 0) {
+            if (cur < 0) {
+                cur = i;
+                curlen = 0;
+            }
+
+            if (++curlen > bestlen) {
+                best = cur;
+                bestlen = curlen;
+            }
+        } else {
+            cur = -1;
+        }
+    }
+
+    if (bestlen < 2) {
+        best = -1;
+    }
+
+    for (i = 0; i < 8; i++) {
+        if (best >= 0 && i >= best && i < best + bestlen) {
+            if (i == best) {
+                dst[n++] = ':';
+            }
+
+            continue;
+        }
+
+        if (i > 0) {
+            dst[n++] = ':';
+        }
+
+        if (i == 6 && best == 0 && 
+                (bestlen == 6 || (bestlen == 5 && words[5] == 0xffff))) {
+            n += tmpl_fmt_ipv4(dst + n, b + 12);
+            break;
+        }
+
+        n += tmpl_fmt_hex16(dst + n, words[i]);
+    }
+
+    if (best >= 0 && best + bestlen == 8) {
+        dst[n++] = ':';
+    }
+
+    if (sin6->sin6_scope_id != 0) {
+        dst[n++] = '%';
+        if ((IN6_IS_ADDR_LINKLOCAL(&sin6->sin6_addr) ||
+                IN6_IS_ADDR_MC_LINKLOCAL(&sin6->sin6_addr)) &&
+                if_indextoname(sin6->sin6_scope_id, ifname) != NULL) {
+            len = strlen(ifname);
+            memcpy(dst + n, ifname, len);
+            n += len;
+        } else {
+            n += tmpl_fmt_uint(dst + n, sin6->sin6_scope_id);
+        }
+    }
+
+    return n;
+}
+
+static size_t tmpl_fmt_addr(char *dst, const yar_addr_t *addr)
+{
+    if (addr->af == AF_INET) {
+        return tmpl_fmt_ipv4(dst, (const unsigned char *)
+                &((const struct sockaddr_in *)&addr->saddr)->sin_addr);
+    }
+
+    return tmpl_fmt_ipv6(dst, (const struct sockaddr_in6 *)&addr->saddr);
+}
+
+/* xorshift64*, seeded once. Not suitable where the nonce must be 
+   unpredictable */
+static uint64_t tmpl_nonce()
+{
+    uint64_t x;
+
+    if (_nonce_state == 0) {
+        _nonce_state = ((uint64_t)time(NULL) << 32) ^ (uint64_t)getpid() ^
+                (uint64_t)(uintptr_t)&_nonce_state;
+        _nonce_state |= 1;
+    }
+
+    x = _nonce_state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    _nonce_state = x;
+    return x * 0x2545f4914f6cdd1dULL;
+}
+
+size_t yar_tmpl_render(const yar_tmpl_t *t, const yar_addr_t *addr,
+        yar_port_t port, void *dst)
+{
+    static const char hex[] = "0123456789abcdef";
+    const struct tmpl_seg *seg;
+    char *out = dst;
+    uint64_t nonce;
+    size_t i, n = 0;
+    int j;
+
+    assert(t != NULL);
+    assert(addr != NULL);
+    assert(dst != NULL);
+
+    for (i = 0; i < t->nsegs; i++) {
+        seg = &t->segs[i];
+        switch (seg->type) {
+        case TMPL_LITERAL:
+            memcpy(out + n, t->lit + seg->off, seg->len);
+            n += seg->len;
+            break;
+        case TMPL_ADDR:
+            n += tmpl_fmt_addr(out + n, addr);
+            break;
+        case TMPL_PORT:
+            n += tmpl_fmt_uint(out + n, port & 0xffff);
+            break;
+        case TMPL_ADDRPORT:
+            if (addr->af == AF_INET) {
+                n += tmpl_fmt_addr(out + n, addr);
+            } else {
+                out[n++] = '[';
+                n += tmpl_fmt_addr(out + n, addr);
+                out[n++] = ']';
+            }
+
+            out[n++] = ':';
+            n += tmpl_fmt_uint(out + n, port & 0xffff);
+            break;
+        case TMPL_NONCE:
+            nonce = tmpl_nonce();
+            for (j = TMPL_NONCE_LEN - 1; j >= 0; j--) {
+                out[n + (size_t)j] = hex[nonce & 0xf];
+                nonce >>= 4;
+            }
+
+            n += TMPL_NONCE_LEN;
+            break;
+        }
+    }
+
+    assert(n <= t->maxlen);
+    return n;
+}
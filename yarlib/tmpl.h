@@ -0,0 +1,71 @@
+/*
+Copyright (c) 2013, Sebastian Cato
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef __TMPL_H
+#define __TMPL_H
+
+#include <stddef.h>
+
+#include "port.h"
+#include "addr.h"
+
+/**
+ * Probe templates. A template is parsed once into literal segments and 
+ * placeholders, and rendered for each endpoint with a single pass that
+ * copies the literals and formats the placeholders in place. 
+ * Placeholders:
+ *
+ *     ${addr}      the address of the endpoint
+ *     ${port}      the port of the endpoint
+ *     ${addrport}  addr:port, or [addr]:port for IPv6
+ *     ${nonce}     16 random hex digits, different for each rendering
+ *     $$           a literal '$'
+ */
+
+typedef struct yar_tmpl yar_tmpl_t;
+
+/**
+ * yar_tmpl_new --
+ *     parse a template
+ *
+ * @return NULL on error, with errno set to EINVAL for an unknown or
+ *         unterminated placeholder
+ */
+yar_tmpl_t *yar_tmpl_new(const char *tmpl, size_t len);
+void yar_tmpl_free(yar_tmpl_t *t);
+
+/* the longest possible rendering of a template */
+size_t yar_tmpl_maxlen(const yar_tmpl_t *t);
+
+/**
+ * yar_tmpl_render --
+ *     render a template for an address and a port into dst, which must 
+ *     hold at least yar_tmpl_maxlen bytes. The result is not terminated
+ *
+ * @return the length of the result
+ */
+size_t yar_tmpl_render(const yar_tmpl_t *t, const yar_addr_t *addr,
+        yar_port_t port, void *dst);
+
+#endif
@@ -0,0 +1,392 @@
+/*
+Copyright (c) 2013, Sebastian Cato
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#include <assert.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RV_HAVE_X86 1
+#endif
+
+#include "validators.h"
+
+/* the last bytes of a segment are kept in yar_rvstate.state to match a
+   delimiter that spans segments. The low byte is the most recent one and
+   the number of bytes kept is stored above them */
+#define RV_HIST_SHIFT   24
+#define RV_HIST_MASK    0xffffff
+
+/* byte search implementation; return the offset of the match, or len */
+struct rv_search {
+    int level;
+    size_t (*find_byte)(const unsigned char *p, size_t len, unsigned char c);
+    size_t (*find_crlfcrlf)(const unsigned char *p, size_t len);
+};
+
+static size_t rv_find_byte_scalar(const unsigned char *p, size_t len,
+        unsigned char c)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (p[i] == c) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+static size_t rv_find_crlfcrlf_scalar(const unsigned char *p, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i + 4 <= len; i++) {
+        /* the last byte of the terminator rules out most positions */
+        if (p[i+3] != '\n') {
+            continue;
+        } else if (p[i] == '\r' && p[i+1] == '\n' && p[i+2] == '\r') {
+            return i;
+        }
+    }
+
+    return len;
+}
+
+#if defined(__SSE2__)
+static size_t rv_find_byte_sse2(const unsigned char *p, size_t len,
+        unsigned char c)
+{
+    __m128i needle = _mm_set1_epi8((char)c), v;
+    size_t i;
+    int mask;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        v = _mm_loadu_si128((const __m128i *)(p + i));
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    return i + rv_find_byte_scalar(p + i, len - i, c);
+}
+
+/* compares four overlapping loads against the terminator, one byte 
+   position each, so a match can start anywhere in the block */
+static size_t rv_find_crlfcrlf_sse2(const unsigned char *p, size_t len)
+{
+    __m128i cr = _mm_set1_epi8('\r'), lf = _mm_set1_epi8('\n'), m;
+    size_t i;
+    int mask;
+
+    for (i = 0; i + 19 <= len; i += 16) {
+        m = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i + 3)), lf);
+        if (_mm_movemask_epi8(m) == 0) {
+            continue;
+        }
+
+        m = _mm_and_si128(m, _mm_cmpeq_epi8(
+                _mm_loadu_si128((const __m128i *)(p + i)), cr));
+        m = _mm_and_si128(m, _mm_cmpeq_epi8(
+                _mm_loadu_si128((const __m128i *)(p + i + 1)), lf));
+        m = _mm_and_si128(m, _mm_cmpeq_epi8(
+                _mm_loadu_si128((const __m128i *)(p + i + 2)), cr));
+        mask = _mm_movemask_epi8(m);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    return i + rv_find_crlfcrlf_scalar(p + i, len - i);
+}
+#endif
+
+#if defined(RV_HAVE_X86) && defined(__GNUC__)
+#define RV_HAVE_AVX2 1
+__attribute__((target("avx2")))
+static size_t rv_find_byte_avx2(const unsigned char *p, size_t len,
+        unsigned char c)
+{
+    __m256i needle = _mm256_set1_epi8((char)c), v;
+    size_t i;
+    unsigned int mask;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        v = _mm256_loadu_si256((const __m256i *)(p + i));
+        mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, 
+                needle));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    /* the compiler does not always do this on its own before the call, 
+       and the SSE code that follows would pay for the dirty state */
+    _mm256_zeroupper();
+    return i + rv_find_byte_scalar(p + i, len - i, c);
+}
+
+__attribute__((target("avx2")))
+static size_t rv_find_crlfcrlf_avx2(const unsigned char *p, size_t len)
+{
+    __m256i cr = _mm256_set1_epi8('\r'), lf = _mm256_set1_epi8('\n'), m;
+    size_t i;
+    unsigned int mask;
+
+    for (i = 0; i + 35 <= len; i += 32) {
+        m = _mm256_cmpeq_epi8(
+                _mm256_loadu_si256((const __m256i *)(p + i + 3)), lf);
+        if (_mm256_movemask_epi8(m) == 0) {
+            continue;
+        }
+
+        m = _mm256_and_si256(m, _mm256_cmpeq_epi8(
+                _mm256_loadu_si256((const __m256i *)(p + i)), cr));
+        m = _mm256_and_si256(m, _mm256_cmpeq_epi8(
+                _mm256_loadu_si256((const __m256i *)(p + i + 1)), lf));
+        m = _mm256_and_si256(m, _mm256_cmpeq_epi8(
+                _mm256_loadu_si256((const __m256i *)(p + i + 2)), cr));
+        mask = (unsigned int)_mm256_movemask_epi8(m);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    _mm256_zeroupper();
+    return i + rv_find_crlfcrlf_scalar(p + i, len - i);
+}
+#endif
+
+static const struct rv_search _searches[] = {
+    {RV_SIMD_SCALAR, rv_find_byte_scalar, rv_find_crlfcrlf_scalar},
+#if defined(__SSE2__)
+    {RV_SIMD_SSE2, rv_find_byte_sse2, rv_find_crlfcrlf_sse2},
+#endif
+#if defined(RV_HAVE_AVX2)
+    {RV_SIMD_AVX2, rv_find_byte_avx2, rv_find_crlfcrlf_avx2},
+#endif
+};
+
+#define NSEARCHES (sizeof(_searches) / sizeof(*_searches))
+
+static const struct rv_search *_search = NULL;
+
+static int rv_simd_supported(int level)
+{
+#if defined(RV_HAVE_AVX2)
+    if (level == RV_SIMD_AVX2) {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+
+    return 1;
+}
+
+int yar_rv_set_simd(int level)
+{
+    size_t i;
+
+    for (i = NSEARCHES; i > 0; i--) {
+        if ((level == RV_SIMD_AUTO || level == _searches[i-1].level) &&
+                rv_simd_supported(_searches[i-1].level)) {
+            _search = &_searches[i-1];
+            return _search->level;
+        }
+    }
+
+    return -1;
+}
+
+static inline const struct rv_search *rv_search()
+{
+    if (_search == NULL) {
+        yar_rv_set_simd(RV_SIMD_AUTO);
+        assert(_search != NULL);
+    }
+
+    return _search;
+}
+
+int yar_rv_crlfcrlf(const void *data, size_t len)
+{
+    if (rv_search()->find_crlfcrlf(data, len) < len) {
+        return RVALIDATOR_OK;
+    }
+
+    return RVALIDATOR_INCOMPLETE;
+}
+
+int yar_rv_crlfcrlf_inc(struct yar_rvstate *st, const void *data, 
+        size_t len)
+{
+    static const unsigned char term[] = "\r\n\r\n";
+    const unsigned char *p = data;
+    unsigned char win[6];
+    unsigned long hist;
+    size_t i, nhist, nwin = 0, pos;
+
+    assert(st != NULL);
+
+    /* a terminator that starts in an earlier segment */
+    hist = st->state & RV_HIST_MASK;
+    nhist = st->state >> RV_HIST_SHIFT;
+    for (i = nhist; i > 0; i--) {
+        win[nwin++] = (hist >> (8 * (i - 1))) & 0xff;
+    }
+
+    for (i = 0; i < len && i < 3; i++) {
+        win[nwin++] = p[i];
+    }
+
+    for (i = 0; i + 4 <= nwin; i++) {
+        if (i + 4 > nhist && memcmp(win + i, term, 4) == 0) {
+            st->msglen = st->off + i + 4 - nhist;
+            return RVALIDATOR_OK;
+        }
+    }
+
+    pos = rv_search()->find_crlfcrlf(p, len);
+    if (pos < len) {
+        st->msglen = st->off + pos + 4;
+        return RVALIDATOR_OK;
+    }
+
+    /* keep the last three bytes of the input */
+    for (i = len > 3 ? len - 3 : 0; i < len; i++) {
+        hist = (hist << 8) | p[i];
+        if (nhist < 3) {
+            nhist++;
+        }
+    }
+
+    st->state = (hist & RV_HIST_MASK) | (nhist << RV_HIST_SHIFT);
+    return RVALIDATOR_INCOMPLETE;
+}
+
+int yar_rv_line(const void *data, size_t len)
+{
+    if (rv_search()->find_byte(data, len, '\n') < len) {
+        return RVALIDATOR_OK;
+    }
+
+    return RVALIDATOR_INCOMPLETE;
+}
+
+int yar_rv_line_inc(struct yar_rvstate *st, const void *data, size_t len)
+{
+    size_t pos;
+
+    assert(st != NULL);
+
+    pos = rv_search()->find_byte(data, len, '\n');
+    if (pos < len) {
+        st->msglen = st->off + pos + 1;
+        return RVALIDATOR_OK;
+    }
+
+    return RVALIDATOR_INCOMPLETE;
+}
+
+int yar_rv_fixed_inc(struct yar_rvstate *st, const void *data, size_t len)
+{
+    const size_t *size;
+
+    assert(st != NULL);
+    assert(st->arg != NULL);
+
+    size = st->arg;
+    assert(*size > 0);
+    if (st->off + len >= *size) {
+        st->msglen = *size;
+        return RVALIDATOR_OK;
+    }
+
+    return RVALIDATOR_INCOMPLETE;
+}
+
+/* st->state accumulates the length field, st->msglen is set once the 
+   field is complete */
+int yar_rv_lenprefix_inc(struct yar_rvstate *st, const void *data,
+        size_t len)
+{
+    const struct yar_rv_lenprefix *lp;
+    const unsigned char *p = data;
+    unsigned long val;
+    size_t i, fend;
+
+    assert(st != NULL);
+    assert(st->arg != NULL);
+
+    lp = st->arg;
+    assert(lp->width > 0 && lp->width <= sizeof(st->state));
+    fend = lp->offset + lp->width;
+    if (st->msglen == 0) {
+        i = st->off < lp->offset ? lp->offset - st->off : 0;
+        for (; i < len && st->off + i < fend; i++) {
+            if (lp->bigendian) {
+                st->state = (st->state << 8) | p[i];
+            } else {
+                st->state |= (unsigned long)p[i] << 
+                        (8 * (st->off + i - lp->offset));
+            }
+        }
+
+        if (st->off + len < fend) {
+            return RVALIDATOR_INCOMPLETE;
+        }
+
+        val = st->state;
+        if (lp->adjust < 0) {
+            if (val < (unsigned long)-lp->adjust) {
+                return RVALIDATOR_INCORRECT;
+            }
+
+            val -= (unsigned long)-lp->adjust;
+        } else {
+            if (val > ULONG_MAX - (unsigned long)lp->adjust) {
+                return RVALIDATOR_INCORRECT;
+            }
+
+            val += (unsigned long)lp->adjust;
+        }
+
+        if (val < fend || val > SIZE_MAX || 
+                (lp->max > 0 && val > lp->max)) {
+            return RVALIDATOR_INCORRECT;
+        }
+
+        st->msglen = (size_t)val;
+    }
+
+    if (st->off + len >= st->msglen) {
+        return RVALIDATOR_OK;
+    }
+
+    return RVALIDATOR_INCOMPLETE;
+}
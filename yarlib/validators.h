@@ -0,0 +1,84 @@
+/*
+Copyright (c) 2013, Sebastian Cato
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __VALIDATORS_H
+#define __VALIDATORS_H
+
+#include "yar.h"
+
+/**
+ * Read validators for common framings. The *_inc variants are incremental
+ * validators for yar_client.read_validator_inc and report the length of
+ * the first message through yar_endpoint_msglen, so that pipelined 
+ * messages can be consumed one at a time. The others are whole-buffer
+ * validators for yar_client.read_validator. Delimiters are searched for 
+ * with SSE2 or AVX2, depending on what the CPU supports.
+ */
+
+/* header terminator: "\r\n\r\n" */
+int yar_rv_crlfcrlf(const void *data, size_t len);
+int yar_rv_crlfcrlf_inc(struct yar_rvstate *st, const void *data, 
+        size_t len);
+
+/* newline terminated line */
+int yar_rv_line(const void *data, size_t len);
+int yar_rv_line_inc(struct yar_rvstate *st, const void *data, size_t len);
+
+/* fixed size messages. cli->read_validator_arg points to a size_t with
+   the message size */
+int yar_rv_fixed_inc(struct yar_rvstate *st, const void *data, size_t len);
+
+/* length prefixed messages. cli->read_validator_arg points to a 
+   struct yar_rv_lenprefix. The message length is the value of the length 
+   field plus adjust; messages shorter than the end of the length field or
+   longer than max are incorrect */
+struct yar_rv_lenprefix {
+    size_t offset;      /* offset of the length field */
+    unsigned int width; /* size of the length field: 1, 2, 4 or 8 bytes */
+    int bigendian;      /* byte order of the length field */
+    long adjust;        /* e.g., the size of the header if the length field
+                           does not include it */
+    size_t max;         /* longest accepted message, 0 for no limit */
+};
+
+int yar_rv_lenprefix_inc(struct yar_rvstate *st, const void *data,
+        size_t len);
+
+/* byte search implementations, RV_SIMD_AUTO selects the best one the CPU
+   supports (the default) */
+#define RV_SIMD_AUTO    -1
+#define RV_SIMD_SCALAR  0
+#define RV_SIMD_SSE2    1
+#define RV_SIMD_AVX2    2
+
+/**
+ * yar_rv_set_simd --
+ *     select the byte search implementation used by the validators
+ *
+ * @return the selected level, or -1 if the level is not supported
+ */
+int yar_rv_set_simd(int level);
+
+#endif
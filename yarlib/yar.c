@@ -23,12 +23,21 @@ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
+#define _GNU_SOURCE /* sendmmsg(2), recvmmsg(2) */
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <limits.h>
 #include <stdio.h>
 #include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#ifdef __linux__
+#include <sys/timerfd.h>
+#endif
 #include <event2/event.h>
 #include <event2/bufferevent.h>
 #include <event2/buffer.h>
@@ -52,41 +61,572 @@ static struct event_base *_evbase = NULL;
         } \
     } while (0);
 
+/**
+ * total number of bytes buffered by endpoints, tracked when a memory 
+ * budget is set. New connections are not dispatched while it is exceeded
+ */
+static size_t _membudget = 0;
+static size_t _membuffered = 0;
+
+/* global metrics, and those of the client if it has its own */
+static struct yar_metrics _metrics;
+#define METRICS_ADD(cli, field, n) \
+    do { \
+        _metrics.field += (n); \
+        if ((cli)->metrics != NULL) { \
+            (cli)->metrics->field += (n); \
+        } \
+    } while (0)
+#define METRICS_SUB(cli, field, n) \
+    do { \
+        _metrics.field -= (n); \
+        if ((cli)->metrics != NULL) { \
+            (cli)->metrics->field -= (n); \
+        } \
+    } while (0)
+
+/**
+ * Global job scheduler, enabled by yar_set_limits. The connect tickers of
+ * scheduled jobs do not dispatch on their own, they only work out how many
+ * connections their own limits allow for the tick. A single scheduler 
+ * ticker dispatches connections for all of them within the global budgets
+ * by deficit round-robin, where each job's quantum is proportional to 
+ * cli->weight. Jobs leave the rotation when they are done dispatching, 
+ * and the others share what they leave.
+ */
+#define SCHED_TICKRATE 100
+struct yar_sched {
+    unsigned int ncc;       /* global concurrency limit, 0 for none */
+    unsigned int cps;       /* global connection rate, 0 for none */
+    uint64_t frac;          /* rate budget carried over between ticks */
+    struct yar_connect_ticker *jobs;
+    struct yar_connect_ticker *next; /* where the next round starts */
+    bool running;
+};
+
+static struct yar_sched _sched;
+
+/**
+ * Tickers fire on deadlines on the monotonic clock, start + k * period, so
+ * the rate does not drift with callback latency or loop load. Ticks that
+ * were due while the loop was busy are not fired separately, their number
+ * is passed to the next call instead. On Linux, a timerfd keeps the 
+ * deadlines and counts the expirations. Elsewhere, a one-shot timeout is
+ * armed for the next deadline after each tick.
+ */
+#define NSEC_PER_SEC 1000000000ULL
 struct yar_ticker {
     struct event *ev;
     yar_ticker_func f;
     void *data;
     yar_cleanup_func free_cb;
+    uint64_t period;    /* nanoseconds */
+    uint64_t next;      /* next deadline */
+    int fd;             /* timerfd, or -1 */
+    struct yar_sim_timer vt; /* used instead of ev in simulations */
+};
+
+/* the simulated network, if set. See yar_set_sim */
+static yar_sim_t *_sim = NULL;
+#define SIM_POLL_INTERVAL 4096 /* virtual events between libevent polls */
+
+/* the real clock, even in simulations */
+static uint64_t yar_clock_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+/* the clock of tickers and timeouts, virtual in simulations */
+static uint64_t yar_monotonic_ns()
+{
+    return _sim != NULL ? yar_sim_now(_sim) : yar_clock_ns();
+}
+
+/* timestamps of endpoint events */
+static uint64_t yar_now_us()
+{
+    return yar_monotonic_ns() / 1000;
+}
+
+/**
+ * Callback profiling, enabled by yar_set_profiling. Every callback is
+ * counted, but only one in every 'rate' is timed, so that the cost is a 
+ * decrement per call and two clock reads per timed call.
+ */
+static struct {
+    unsigned int rate;      /* 0 when disabled */
+    unsigned int countdown; /* calls left until the next timed one */
+    unsigned int slow_us;
+    yar_sink_t *sink;       /* slow callbacks are logged here, if set */
+    struct yar_profile p;
+} _prof;
+
+/* start timing a callback, if it is its turn. Returns 0 if not */
+static uint64_t yar_profile_start(unsigned int type)
+{
+    _prof.p.ncalls[type]++;
+    if (--_prof.countdown > 0) {
+        return 0;
+    }
+
+    /* callbacks take no virtual time, so time them on the real clock */
+    _prof.countdown = _prof.rate;
+    return yar_clock_ns() / 1000;
+}
+
+static void yar_profile_end(unsigned int type, uint64_t start,
+        const yar_addr_t *addr, yar_port_t port)
+{
+    char addrbuf[ADDR_STRLEN], portbuf[16];
+    uint64_t usec;
+
+    usec = yar_clock_ns() / 1000 - start;
+    yar_profile_record(&_prof.p, type, usec, addr, port);
+    if (_prof.sink != NULL && _prof.slow_us > 0 && usec >= _prof.slow_us) {
+        if (addr != NULL) {
+            yar_addr_to_str(addr, addrbuf);
+            yar_port_to_str(port, portbuf, sizeof(portbuf));
+        } else {
+            strcpy(addrbuf, "-");
+            strcpy(portbuf, "-");
+        }
+
+        yar_sink_printf(_prof.sink, "slow callback: %s %llu us %s %s\n",
+                yar_cbtype_str(type), (unsigned long long)usec, addrbuf, 
+                portbuf);
+    }
+}
+
+/* call an endpoint handler, timing it when profiling */
+static void yar_endpoint_call(yar_endpoint_handler f, unsigned int type, 
+        struct yar_endpoint *ep)
+{
+    uint64_t start;
+
+    if (_prof.rate == 0 || (start = yar_profile_start(type)) == 0) {
+        f(ep);
+        return;
+    }
+
+    /* ep outlives the handler, it is freed by the caller */
+    f(ep);
+    yar_profile_end(type, start, &ep->addr, ep->port);
+}
+
+/**
+ * libevent keeps timeouts in a min-heap, where adding and removing is
+ * O(log n). Timeouts registered as common timeouts are kept in per-duration
+ * queues instead, which makes arming and cancelling O(1). Virtually all
+ * connections of a client use the same few durations, so these are 
+ * registered once per duration and shared. libevent limits the number of
+ * common timeouts per event_base, so plain timeouts are used as a fallback
+ */
+#define YAR_MAX_COMMON_TIMEOUTS 64
+static struct {
+    unsigned int usec;
+    const struct timeval *tv;
+} _common_timeouts[YAR_MAX_COMMON_TIMEOUTS];
+static size_t _ncommon_timeouts = 0;
+
+struct yar_timeouts {
+    const struct timeval *connect;
+    const struct timeval *read;
+    const struct timeval *write;
+    const struct timeval *total;
+
+    /* storage for timeouts that could not be made common */
+    struct timeval fallback[4];
+};
+
+/**
+ * Datagram endpoints do not get a socket of their own. A job sends all its
+ * datagrams from a few shared sockets per address family, in batches of
+ * UDP_BATCH datagrams per sendmmsg(2) call, and responses are received in
+ * batches with recvmmsg(2). Received datagrams are mapped back to their
+ * endpoint by source address and port.
+ */
+#define UDP_BATCH           64      /* datagrams per sendmmsg/recvmmsg */
+#define UDP_NSOCKS          4       /* default sockets per address family */
+#define UDP_DGRAM_MAX       8192    /* max received datagram size */
+#define UDP_SOCKBUF         (4*1024*1024)
+#define UDP_RX_ROUNDS       16      /* max recvmmsg calls per read event */
+
+#ifndef __linux__
+struct mmsghdr {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+};
+
+static int sendmmsg(int fd, struct mmsghdr *msgs, unsigned int n, int flags)
+{
+    unsigned int i;
+    ssize_t ret;
+
+    for (i = 0; i < n; i++) {
+        ret = sendmsg(fd, &msgs[i].msg_hdr, flags);
+        if (ret < 0) {
+            return i > 0 ? (int)i : -1;
+        }
+
+        msgs[i].msg_len = (unsigned int)ret;
+    }
+
+    return (int)n;
+}
+
+static int recvmmsg(int fd, struct mmsghdr *msgs, unsigned int n, int flags,
+        struct timespec *timeout)
+{
+    unsigned int i;
+    ssize_t ret;
+
+    for (i = 0; i < n; i++) {
+        ret = recvmsg(fd, &msgs[i].msg_hdr, flags);
+        if (ret < 0) {
+            return i > 0 ? (int)i : -1;
+        }
+
+        msgs[i].msg_len = (unsigned int)ret;
+    }
+
+    return (int)n;
+}
+#endif
+
+/* datagram endpoints of a job and idle connections, keyed on remote 
+   address and port */
+#define EPHASH_MIN_BUCKETS 1024
+struct yar_ephash {
+    struct yar_endpoint_handle **buckets;
+    size_t nbuckets; /* always a power of two */
+    size_t nentries;
+};
+
+struct yar_udp_dgram {
+    struct sockaddr_storage ss;
+    socklen_t sslen;
+    size_t off; /* offset of the payload in the socket's send buffer */
+    size_t len;
+};
+
+struct yar_udp_sock {
+    struct yar_connect_ticker *ticker;
+    evutil_socket_t fd;
+    struct event *rev;
+    struct event *wev;
+
+    /* datagrams waiting for the next sendmmsg */
+    struct yar_udp_dgram *pending;
+    size_t npending, maxpending;
+    unsigned char *buf;
+    size_t buflen, bufsize;
+};
+
+/* receive batch, shared by all sockets of a job */
+struct yar_udp_rx {
+    struct mmsghdr msgs[UDP_BATCH];
+    struct iovec iov[UDP_BATCH];
+    struct sockaddr_storage addrs[UDP_BATCH];
+    unsigned char bufs[UDP_BATCH][UDP_DGRAM_MAX];
+};
+
+struct yar_udp {
+    struct yar_ephash ephash;
+    unsigned int nsocks;
+    struct yar_udp_sock *socks4;
+    struct yar_udp_sock *socks6;
+    struct yar_udp_rx *rx; /* allocated with the first socket */
 };
 
 #define CONNECT_TICKER_FLG_FINISHED_DISPATCHING    1  
+#define CONNECT_TICKER_FLG_SCHEDULED               2  
+#define CONNECT_TICKER_FLG_STOPPED                 4  /* draining */
+#define RTT_NSTEPS 4 /* the shortest adaptive timeout is cto / 8 */
 struct yar_connect_ticker {
     struct yar_client *cli;
+    struct yar_timeouts to;
     yar_addrspec_t *addrspec;
     yar_portspec_t *portspec;
     yar_addr_t curr_addr;
     struct event *ev;
+    struct yar_udp *udp; /* NULL unless cli->proto is ADDRPROTO_UDP */
     unsigned int ncurrent; /* number of established connections */
     unsigned int flags;
+
+    /* CONNECT_TICKER_FLG_SCHEDULED: connections the job's own limits allow
+       for the current tick that the scheduler has not dispatched yet, and
+       its deficit counter. The scheduler may tick many times per job tick */
+    unsigned int allowed;
+    uint64_t deficit;
+    struct yar_connect_ticker *snext;
+
+    /* cli->rtt: the connect timeouts endpoints can get, as steps halving 
+       from the configured one, shortest first */
+    unsigned int rttusec[RTT_NSTEPS];
+    const struct timeval *rttto[RTT_NSTEPS];
+    struct timeval rttfallback[RTT_NSTEPS];
+
+    /* job lifecycle: the open endpoints of the job, when it started, and
+       when to close what is left once it has been stopped */
+    struct yar_connect_ticker *jnext;
+    struct yar_endpoint_handle *live;
+    uint64_t start;
+    uint64_t stop_at;
+    struct yar_job_summary sum;
+};
+
+/* immutable data shared by the output buffers of many endpoints */
+struct yar_payload {
+    unsigned int refs;
+    size_t len;
+    unsigned char data[];
+};
+
+/* requests queued with yar_endpoint_enqueue, waiting to be written */
+struct yar_request {
+    struct yar_request *next;
+    yar_payload_t *payload; /* written instead of data, if set */
+    size_t len;
+    unsigned char data[];
 };
 
+#define EPH_FLG_ESTABLISHED     1
+#define EPH_FLG_SHUTDOWN_WR     2 /* shutdown(SHUT_WR) has been called */
+#define EPH_FLG_GOT_INPUT       4 /* time to first byte has been recorded */
+#define EPH_FLG_RTT_CTO         8 /* the connect timeout is from cli->rtt */
 struct yar_endpoint_handle {
     struct yar_connect_ticker *ticker;
+    struct yar_endpoint *ep;
     struct bufferevent *bev;
-    
+    struct event *deadline; /* total connection deadline, if any */
+    unsigned int flags;
+    struct timeval tstart;  /* dispatch time, wall clock */
+    struct yar_endpoint_times times;
+
+    /* request queue */
+    struct yar_request *reqhead, **reqtail;
+    unsigned int nqueued; /* queued, not yet written */
+    unsigned int nsent;   /* written, waiting for a response */
+
+    /* incremental read validator state */
+    struct yar_rvstate rvs;
+
+    /* bytes consumed by the on_read handler during the current call */
+    size_t consumed;
+
+    /* bytes at the start of the input counted in bytes_in */
+    size_t incounted;
+
+    /* multi-pattern matcher state. mscanned is the number of bytes at the
+       start of the input that have been scanned */
+    unsigned int mstate;
+    size_t mscanned;
+    unsigned int *matches;
+    size_t nmatches;
+    size_t matchcap;
+
+    /* input and output byte counters for the memory budget */
+    struct evbuffer_cb_entry *memcb[2];
+
+    /* datagram endpoints have no bufferevent of their own */
+    struct yar_udp_sock *usock;
+    struct evbuffer *input;
+    struct event *timer;
+    uint32_t hkey;
+    struct yar_endpoint_handle *hnext;
+
+    /* the job's list of open endpoints */
+    struct yar_endpoint_handle *lnext, **lprev;
+
+    /* simulated endpoints have no socket, see yar_sim_endpoint_new */
+    struct yar_sim_conn *sim;
+
     /* caller data, for storing stuff related to an endpoint connection */
     void *cdata;
     yar_cleanup_func free_cb;
 };
 
+static uint32_t yar_ephash_sum(const struct sockaddr *sa)
+{
+    const unsigned char *p;
+    uint32_t h = 2166136261u; /* FNV-1a */
+    uint16_t port;
+    size_t i, len;
+
+    assert(sa != NULL);
+
+    if (sa->sa_family == AF_INET) {
+        p = (const unsigned char *)&((struct sockaddr_in *)sa)->sin_addr;
+        len = sizeof(struct in_addr);
+        port = ((struct sockaddr_in *)sa)->sin_port;
+    } else {
+        p = (const unsigned char *)&((struct sockaddr_in6 *)sa)->sin6_addr;
+        len = sizeof(struct in6_addr);
+        port = ((struct sockaddr_in6 *)sa)->sin6_port;
+    }
+
+    for (i = 0; i < len; i++) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+
+    h = (h ^ (port & 0xff)) * 16777619u;
+    h = (h ^ (port >> 8)) * 16777619u;
+    return h;
+}
+
+static bool yar_ephash_match(const struct yar_endpoint *ep, 
+        const struct sockaddr *sa)
+{
+    const struct sockaddr_in *sin, *epsin;
+    const struct sockaddr_in6 *sin6, *epsin6;
+
+    if (ep->addr.af != sa->sa_family) {
+        return false;
+    }
+
+    if (sa->sa_family == AF_INET) {
+        sin = (const struct sockaddr_in *)sa;
+        epsin = (const struct sockaddr_in *)&ep->addr.saddr;
+        return ntohs(sin->sin_port) == ep->port && 
+                sin->sin_addr.s_addr == epsin->sin_addr.s_addr;
+    } else {
+        sin6 = (const struct sockaddr_in6 *)sa;
+        epsin6 = (const struct sockaddr_in6 *)&ep->addr.saddr;
+        return ntohs(sin6->sin6_port) == ep->port &&
+                memcmp(&sin6->sin6_addr, &epsin6->sin6_addr,
+                        sizeof(struct in6_addr)) == 0;
+    }
+}
+
+static int yar_ephash_grow(struct yar_ephash *h)
+{
+    struct yar_endpoint_handle **buckets, *curr, *next;
+    size_t i, nbuckets;
+
+    nbuckets = h->nbuckets > 0 ? h->nbuckets * 2 : EPHASH_MIN_BUCKETS;
+    buckets = calloc(nbuckets, sizeof(*buckets));
+    if (buckets == NULL) {
+        return -1;
+    }
+
+    for (i = 0; i < h->nbuckets; i++) {
+        for (curr = h->buckets[i]; curr != NULL; curr = next) {
+            next = curr->hnext;
+            curr->hnext = buckets[curr->hkey & (nbuckets-1)];
+            buckets[curr->hkey & (nbuckets-1)] = curr;
+        }
+    }
+
+    free(h->buckets);
+    h->buckets = buckets;
+    h->nbuckets = nbuckets;
+    return 0;
+}
+
+static struct yar_endpoint_handle *yar_ephash_lookup(struct yar_ephash *h,
+        const struct sockaddr *sa, uint32_t hkey)
+{
+    struct yar_endpoint_handle *curr;
+
+    if (h->nbuckets == 0) {
+        return NULL;
+    }
+
+    for (curr = h->buckets[hkey & (h->nbuckets-1)]; curr != NULL; 
+            curr = curr->hnext) {
+        if (curr->hkey == hkey && yar_ephash_match(curr->ep, sa)) {
+            return curr;
+        }
+    }
+
+    return NULL;
+}
+
+static int yar_ephash_insert(struct yar_ephash *h, 
+        struct yar_endpoint_handle *eph)
+{
+    size_t ix;
+
+    if (h->nentries >= h->nbuckets && yar_ephash_grow(h) < 0) {
+        return -1;
+    }
+
+    ix = eph->hkey & (h->nbuckets-1);
+    eph->hnext = h->buckets[ix];
+    h->buckets[ix] = eph;
+    h->nentries++;
+    return 0;
+}
+
+static void yar_ephash_remove(struct yar_ephash *h, 
+        struct yar_endpoint_handle *eph)
+{
+    struct yar_endpoint_handle **curr;
+
+    if (h->nbuckets == 0) {
+        return;
+    }
+
+    for (curr = &h->buckets[eph->hkey & (h->nbuckets-1)]; *curr != NULL;
+            curr = &(*curr)->hnext) {
+        if (*curr == eph) {
+            *curr = eph->hnext;
+            eph->hnext = NULL;
+            h->nentries--;
+            return;
+        }
+    }
+}
+
+/**
+ * Established connections released with yar_endpoint_release are kept
+ * here, shared by all jobs, and are handed out again when a job dispatches
+ * a connection to the same address and port. The pool is emptied when the
+ * last job finishes, so pooled connections never keep yar_main running
+ */
+static struct yar_ephash _pool;
+static unsigned int _njobs = 0;
+static struct yar_connect_ticker *_jobs = NULL;
+
+/* add an endpoint to the open endpoints of a job */
+static void yar_job_attach(struct yar_connect_ticker *ticker,
+        struct yar_endpoint_handle *eph)
+{
+    eph->ticker = ticker;
+    eph->lnext = ticker->live;
+    if (eph->lnext != NULL) {
+        eph->lnext->lprev = &eph->lnext;
+    }
+
+    eph->lprev = &ticker->live;
+    ticker->live = eph;
+    ticker->ncurrent++;
+    METRICS_ADD(ticker->cli, live, 1);
+}
+
+static void yar_job_detach(struct yar_endpoint_handle *eph)
+{
+    *eph->lprev = eph->lnext;
+    if (eph->lnext != NULL) {
+        eph->lnext->lprev = eph->lprev;
+    }
+
+    eph->ticker->ncurrent--;
+    METRICS_SUB(eph->ticker->cli, live, 1);
+}
+
 static struct yar_endpoint_handle *yar_endpoint_handle_new(
         struct yar_connect_ticker *ticker,
+        struct yar_endpoint *ep,
         struct bufferevent *bev)
 {
     struct yar_endpoint_handle *eph;
 
     assert(ticker != NULL);
-    assert(bev != NULL);
+    assert(ep != NULL);
 
     eph = malloc(sizeof(*eph));
     if (eph == NULL) {
@@ -94,22 +634,130 @@ static struct yar_endpoint_handle *yar_endpoint_handle_new(
     }
 
     memset(eph, 0, sizeof(*eph));
-    eph->ticker = ticker;
+    eph->ep = ep;
     eph->bev = bev;
+    eph->reqtail = &eph->reqhead;
+    evutil_gettimeofday(&eph->tstart, NULL);
+    eph->times.dispatch = yar_now_us();
+    yar_job_attach(ticker, eph);
     return eph;
 }
 
+static void yar_membuffered_cb(struct evbuffer *buf, 
+        const struct evbuffer_cb_info *info, void *arg)
+{
+    _membuffered += info->n_added;
+    _membuffered -= info->n_deleted;
+}
+
+static void yar_endpoint_track_memory(struct yar_endpoint_handle *eph)
+{
+    if (eph->bev != NULL) {
+        eph->memcb[0] = evbuffer_add_cb(bufferevent_get_input(eph->bev),
+                yar_membuffered_cb, NULL);
+        eph->memcb[1] = evbuffer_add_cb(bufferevent_get_output(eph->bev),
+                yar_membuffered_cb, NULL);
+    } else if (eph->input != NULL) {
+        eph->memcb[0] = evbuffer_add_cb(eph->input, yar_membuffered_cb, 
+                NULL);
+    }
+}
+
+static void yar_endpoint_untrack_memory(struct yar_endpoint_handle *eph)
+{
+    struct evbuffer *bufs[2];
+    size_t i;
+
+    if (eph->bev != NULL) {
+        bufs[0] = bufferevent_get_input(eph->bev);
+        bufs[1] = bufferevent_get_output(eph->bev);
+    } else {
+        bufs[0] = eph->input;
+        bufs[1] = NULL;
+    }
+
+    for (i = 0; i < 2; i++) {
+        if (eph->memcb[i] != NULL) {
+            _membuffered -= evbuffer_get_length(bufs[i]);
+            evbuffer_remove_cb_entry(bufs[i], eph->memcb[i]);
+            eph->memcb[i] = NULL;
+        }
+    }
+}
+
+/**
+ * Simulated connections. The model decides what happens to each attempt, 
+ * and the network events and timeouts of the connection are timers on 
+ * the virtual clock
+ */
+#define SIM_CONN_CONNECTING     0
+#define SIM_CONN_WAITING        1 /* established, waiting for a request */
+#define SIM_CONN_RESPONDING     2 /* a response is on its way */
+#define SIM_CONN_CLOSING        3 /* EOF is on its way */
+struct yar_sim_conn {
+    struct yar_sim_target target;
+    unsigned int state;
+    struct yar_sim_timer net;       /* the next network event */
+    struct yar_sim_timer timeout;   /* connect or idle read timeout */
+    struct yar_sim_timer deadline;  /* cli->tto */
+};
+
+static void yar_sim_conn_free(struct yar_sim_conn *sc)
+{
+    yar_sim_timer_del(_sim, &sc->net);
+    yar_sim_timer_del(_sim, &sc->timeout);
+    yar_sim_timer_del(_sim, &sc->deadline);
+    free(sc);
+}
+
 static void yar_endpoint_handle_free(struct yar_endpoint_handle **eph)
 {
+    struct yar_request *req;
+
     assert(eph != NULL);
 
     if (*eph != NULL) {
+        yar_endpoint_untrack_memory(*eph);
         if ((*eph)->bev != NULL) {
+            if ((*eph)->ticker != NULL) {
+                /* bytes_out was counted when the data was queued */
+                METRICS_SUB((*eph)->ticker->cli, bytes_out, 
+                        evbuffer_get_length(
+                        bufferevent_get_output((*eph)->bev)));
+            }
+
             bufferevent_free((*eph)->bev);
         }
-    
+
+        if ((*eph)->deadline != NULL) {
+            event_free((*eph)->deadline);
+        }
+
+        if ((*eph)->usock != NULL) {
+            yar_ephash_remove(&(*eph)->ticker->udp->ephash, *eph);
+        }
+
+        if ((*eph)->timer != NULL) {
+            event_free((*eph)->timer);
+        }
+
+        if ((*eph)->input != NULL) {
+            evbuffer_free((*eph)->input);
+        }
+
+        if ((*eph)->sim != NULL) {
+            yar_sim_conn_free((*eph)->sim);
+        }
+
+        while ((req = (*eph)->reqhead) != NULL) {
+            (*eph)->reqhead = req->next;
+            yar_payload_unref(req->payload);
+            free(req);
+        }
+
+        free((*eph)->matches);
         if ((*eph)->ticker != NULL) {
-            (*eph)->ticker->ncurrent--;
+            yar_job_detach(*eph);
         }
 
         if ((*eph)->free_cb != NULL && (*eph)->cdata != NULL) {
@@ -122,351 +770,2532 @@ static void yar_endpoint_handle_free(struct yar_endpoint_handle **eph)
 }
 
 
-static struct yar_connect_ticker *yar_connect_ticker_new(
-        struct yar_client *cli, 
-        const char *addrspec,
-        const char *portspec)
+/* pick the per-phase timeout if set, otherwise the general I/O timeout */
+#define YAR_TIMEOUT(_to, _dflt) ((_to) > 0 ? (_to) : (_dflt))
+
+/**
+ * yar_usec_to_tv --
+ *     convert a timeout in microseconds to a timeval. Returns NULL for a
+ *     zero timeout, which is what libevent expects for "no timeout"
+ */
+static struct timeval *yar_usec_to_tv(unsigned int usec, struct timeval *tv)
 {
-    struct yar_connect_ticker *ticker;
+    assert(tv != NULL);
 
-    ticker = malloc(sizeof(*ticker));
-    if (ticker == NULL) {
+    if (usec == 0) {
         return NULL;
     }
 
-    ticker->cli = cli;
-    ticker->ncurrent = 0;
-    ticker->flags = 0;
-    ticker->ev = NULL;
-    ticker->addrspec = yar_addrspec_new(addrspec);
-    if (ticker->addrspec == NULL) {
-        free(ticker);
+    tv->tv_sec = usec / 1000000;
+    tv->tv_usec = usec % 1000000;
+    return tv;
+}
+
+/**
+ * yar_common_timeout --
+ *     get the common timeout for a duration, registering it with the
+ *     event_base if needed. If no more common timeouts can be registered,
+ *     tv is filled in and returned instead. Returns NULL for a zero timeout
+ */
+static const struct timeval *yar_common_timeout(unsigned int usec, 
+        struct timeval *tv)
+{
+    const struct timeval *ctv;
+    size_t i;
+
+    if (yar_usec_to_tv(usec, tv) == NULL) {
         return NULL;
     }
 
-    if (!yar_addrspec_next(ticker->addrspec, &ticker->curr_addr)) {
-        yar_addrspec_free(ticker->addrspec);
-        free(ticker);
-        return NULL;
+    for (i = 0; i < _ncommon_timeouts; i++) {
+        if (_common_timeouts[i].usec == usec) {
+            return _common_timeouts[i].tv;
+        }
     }
 
-    ticker->portspec = yar_portspec_new(portspec);
-    if (ticker->portspec == NULL) {
-        yar_addrspec_free(ticker->addrspec);
-        free(ticker);
-        return NULL;
+    if (_ncommon_timeouts < YAR_MAX_COMMON_TIMEOUTS) {
+        ctv = event_base_init_common_timeout(_evbase, tv);
+        if (ctv != NULL) {
+            _common_timeouts[_ncommon_timeouts].usec = usec;
+            _common_timeouts[_ncommon_timeouts].tv = ctv;
+            _ncommon_timeouts++;
+            return ctv;
+        }
     }
 
-    return ticker;
+    return tv;
 }
 
-static void yar_connect_ticker_free(void *data)
+static void yar_timeouts_init(struct yar_timeouts *to, 
+        const struct yar_client *cli)
 {
-    struct yar_connect_ticker *ticker = data;
-    if (ticker != NULL) {
-        if (ticker->addrspec != NULL) {
-            yar_addrspec_free(ticker->addrspec);
-        }
+    assert(to != NULL);
+    assert(cli != NULL);
 
-        if (ticker->portspec != NULL) {
-            yar_portspec_free(ticker->portspec);
-        }
+    to->connect = yar_common_timeout(YAR_TIMEOUT(cli->cto, cli->to), 
+            &to->fallback[0]);
+    to->read = yar_common_timeout(YAR_TIMEOUT(cli->rto, cli->to), 
+            &to->fallback[1]);
+    to->write = yar_common_timeout(YAR_TIMEOUT(cli->wto, cli->to), 
+            &to->fallback[2]);
+    to->total = yar_common_timeout(cli->tto, &to->fallback[3]);
+}
 
-        if (ticker->ev != NULL) {
-            event_free(ticker->ev);
-        }
+/* the connect timeout steps of a job with an RTT estimator */
+static void yar_rtt_steps_init(struct yar_connect_ticker *ticker)
+{
+    unsigned int usec, i;
 
-        free(ticker);
+    usec = YAR_TIMEOUT(ticker->cli->cto, ticker->cli->to);
+    for (i = 0; i < RTT_NSTEPS; i++) {
+        ticker->rttusec[i] = usec >> (RTT_NSTEPS - 1 - i);
+        ticker->rttto[i] = yar_common_timeout(ticker->rttusec[i], 
+                &ticker->rttfallback[i]);
     }
 }
-static void yar_client_on_read(struct bufferevent *bev, void *ctx)
+
+/**
+ * yar_connect_timeout --
+ *     the connect timeout of a new endpoint: the shortest step that is not 
+ *     shorter than the estimate for its prefix. Quantizing the estimates 
+ *     keeps the number of common timeouts bounded, and the shortest step
+ *     is a floor for estimates from a few fast samples
+ */
+static const struct timeval *yar_connect_timeout(
+        struct yar_connect_ticker *ticker, struct yar_endpoint_handle *eph)
 {
-    struct yar_endpoint *ep = ctx;
-    struct yar_client *cli;
-    struct evbuffer *evb;
-    size_t len;
-    unsigned char *data = NULL;
-    int ret;
+    unsigned int est, i;
 
-    assert(ep != NULL);
-    assert(ep->handle != NULL);
-    
-    if (ep->handle->bev == NULL) {
-        ep->handle->bev = bev;
+    if (ticker->cli->rtt == NULL || ticker->to.connect == NULL) {
+        return ticker->to.connect;
     }
-    
-    cli = ep->handle->ticker->cli;
-    assert(cli != NULL);
 
-    evb = bufferevent_get_input(bev);
-    len = evbuffer_get_length(evb);
-    if (len > 0) {
-        if (cli->read_validator != NULL) {
-            data = evbuffer_pullup(evb, len);
-            ret = cli->read_validator(data, len);
-            if (ret == RVALIDATOR_INCORRECT) {
-                yar_endpoint_handle_free(&ep->handle);
-                free(ep);
-            } else if (ret == RVALIDATOR_INCOMPLETE) {
-                return;
-            }
-        } 
+    est = yar_rtt_timeout(ticker->cli->rtt, &eph->ep->addr);
+    if (est == 0) {
+        return ticker->to.connect;
+    }
 
-        cli->on_read(ep);
-        evbuffer_drain(evb, len);
-        if (ep->handle == NULL) {
-            free(ep);
+    for (i = 0; i < RTT_NSTEPS - 1; i++) {
+        if (ticker->rttusec[i] >= est && ticker->rttto[i] != NULL) {
+            eph->flags |= EPH_FLG_RTT_CTO;
+            return ticker->rttto[i];
         }
     }
+
+    return ticker->to.connect;
 }
 
-static void yar_client_on_event(struct bufferevent *bev, short events, 
+/* switch from the connect timeout to the idle read and write timeouts */
+static void yar_endpoint_set_io_timeouts(struct yar_endpoint_handle *eph)
+{
+    struct yar_timeouts *to;
+
+    assert(eph != NULL);
+    assert(eph->bev != NULL);
+    to = &eph->ticker->to;
+
+    bufferevent_set_timeouts(eph->bev, to->read, to->write);
+}
+
+static void yar_pool_evict(struct yar_endpoint_handle *eph)
+{
+    yar_ephash_remove(&_pool, eph);
+    free(eph->ep);
+    eph->ep = NULL;
+    yar_endpoint_handle_free(&eph);
+}
+
+/* idle connections are closed on any activity: EOF, errors, timeouts or
+   unsolicited data */
+static void yar_pool_on_read(struct bufferevent *bev, void *ctx)
+{
+    yar_pool_evict(ctx);
+}
+
+static void yar_pool_on_event(struct bufferevent *bev, short events, 
         void *ctx)
 {
-    struct yar_endpoint *ep = ctx;
-    struct yar_client *cli;
-    assert(ep != NULL);
-    assert(ep->handle != NULL);
-    
-    if (ep->handle->bev == NULL) {
-        ep->handle->bev = bev;
+    yar_pool_evict(ctx);
+}
+
+static void yar_pool_clear()
+{
+    struct yar_endpoint_handle *eph;
+    size_t i;
+
+    for (i = 0; i < _pool.nbuckets && _pool.nentries > 0; i++) {
+        while ((eph = _pool.buckets[i]) != NULL) {
+            yar_pool_evict(eph);
+        }
     }
 
-    cli = ep->handle->ticker->cli;
-    assert(cli != NULL);
-    
-    if (events & (BEV_EVENT_ERROR|BEV_EVENT_EOF|BEV_EVENT_TIMEOUT)) {
-        if (cli->on_error != NULL && events & BEV_EVENT_ERROR) {
-            cli->on_error(ep);
-        } else if (cli->on_eof != NULL && events & BEV_EVENT_EOF) {
-            cli->on_eof(ep);
-        } else if (cli->on_timeout != NULL && events & BEV_EVENT_TIMEOUT) {
-            cli->on_timeout(ep);
+    free(_pool.buckets);
+    memset(&_pool, 0, sizeof(_pool));
+}
+
+static void yar_udp_sock_flush(struct yar_udp_sock *us);
+
+static struct yar_udp *yar_udp_new(unsigned int nsocks)
+{
+    struct yar_udp *udp;
+
+    assert(nsocks > 0);
+
+    udp = calloc(1, sizeof(*udp));
+    if (udp == NULL) {
+        return NULL;
+    }
+
+    udp->nsocks = nsocks;
+    return udp;
+}
+
+static struct yar_udp_rx *yar_udp_rx_new()
+{
+    struct yar_udp_rx *rx;
+    size_t i;
+
+    rx = calloc(1, sizeof(*rx));
+    if (rx == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < UDP_BATCH; i++) {
+        rx->iov[i].iov_base = rx->bufs[i];
+        rx->iov[i].iov_len = UDP_DGRAM_MAX;
+        rx->msgs[i].msg_hdr.msg_iov = &rx->iov[i];
+        rx->msgs[i].msg_hdr.msg_iovlen = 1;
+        rx->msgs[i].msg_hdr.msg_name = &rx->addrs[i];
+    }
+
+    return rx;
+}
+
+static void yar_udp_sock_cleanup(struct yar_udp_sock *us)
+{
+    if (us->fd >= 0 && us->npending > 0) {
+        /* best effort, datagrams that would block are lost */
+        yar_udp_sock_flush(us);
+    }
+
+    if (us->rev != NULL) {
+        event_free(us->rev);
+    }
+
+    if (us->wev != NULL) {
+        event_free(us->wev);
+    }
+
+    if (us->fd >= 0) {
+        evutil_closesocket(us->fd);
+    }
+
+    while (us->npending > 0) {
+        _membuffered -= us->pending[--us->npending].len;
+    }
+
+    if (us->pending != NULL) {
+        free(us->pending);
+    }
+
+    if (us->buf != NULL) {
+        free(us->buf);
+    }
+
+    memset(us, 0, sizeof(*us));
+    us->fd = -1;
+}
+
+static void yar_udp_free(struct yar_udp *udp)
+{
+    unsigned int i;
+
+    if (udp != NULL) {
+        for (i = 0; udp->socks4 != NULL && i < udp->nsocks; i++) {
+            yar_udp_sock_cleanup(&udp->socks4[i]);
         }
-        
-        if (ep->handle != NULL) {
-            yar_endpoint_handle_free(&ep->handle);
+
+        for (i = 0; udp->socks6 != NULL && i < udp->nsocks; i++) {
+            yar_udp_sock_cleanup(&udp->socks6[i]);
         }
 
-        free(ep);
-    } else if (events & BEV_EVENT_CONNECTED) {
-        if (cli->on_established != NULL) {
-            cli->on_established(ep);
+        free(udp->socks4);
+        free(udp->socks6);
+        free(udp->rx);
+        free(udp->ephash.buckets);
+        free(udp);
+    }
+}
 
-            if (ep->handle == NULL) {
-                free(ep);
-            }
+static struct yar_connect_ticker *yar_connect_ticker_new(
+        struct yar_client *cli, 
+        const char *addrspec,
+        const char *portspec)
+{
+    struct yar_connect_ticker *ticker;
+
+    ticker = malloc(sizeof(*ticker));
+    if (ticker == NULL) {
+        return NULL;
+    }
+
+    ticker->cli = cli;
+    ticker->ncurrent = 0;
+    ticker->flags = 0;
+    ticker->ev = NULL;
+    ticker->udp = NULL;
+    ticker->allowed = 0;
+    ticker->deficit = 0;
+    ticker->snext = NULL;
+    ticker->live = NULL;
+    ticker->start = yar_now_us();
+    ticker->stop_at = 0;
+    memset(&ticker->sum, 0, sizeof(ticker->sum));
+    yar_timeouts_init(&ticker->to, cli);
+    if (cli->rtt != NULL) {
+        yar_rtt_steps_init(ticker);
+    }
+
+    ticker->addrspec = yar_addrspec_new(addrspec);
+    if (ticker->addrspec == NULL) {
+        free(ticker);
+        return NULL;
+    }
+
+    if (!yar_addrspec_next(ticker->addrspec, &ticker->curr_addr)) {
+        yar_addrspec_free(ticker->addrspec);
+        free(ticker);
+        return NULL;
+    }
+
+    ticker->portspec = yar_portspec_new(portspec);
+    if (ticker->portspec == NULL) {
+        yar_addrspec_free(ticker->addrspec);
+        free(ticker);
+        return NULL;
+    }
+
+    if (cli->proto == ADDRPROTO_UDP) {
+        ticker->udp = yar_udp_new(cli->nudp > 0 ? cli->nudp : UDP_NSOCKS);
+        if (ticker->udp == NULL) {
+            yar_portspec_free(ticker->portspec);
+            yar_addrspec_free(ticker->addrspec);
+            free(ticker);
+            return NULL;
         }
     }
+
+    ticker->jnext = _jobs;
+    _jobs = ticker;
+    _njobs++;
+    return ticker;
 }
 
-static void yar_connect_ticker_dispatch_connections(
-        struct yar_connect_ticker *ticker, unsigned int nconns)
+static void yar_sched_remove(struct yar_connect_ticker *ticker)
 {
-    struct yar_endpoint *ep = NULL;
-    struct yar_client *cli;
-    yar_port_t port;
-    struct bufferevent *bev;
-    bufferevent_data_cb on_read;
-    struct timeval tv;
-    evutil_socket_t fd;
-    struct sockaddr_storage ss;
-    socklen_t sslen = 0;
+    struct yar_connect_ticker **curr;
 
-    assert(ticker != NULL);
-    cli = ticker->cli;
-    assert(cli != NULL);
-    assert(nconns > 0);
+    for (curr = &_sched.jobs; *curr != NULL; curr = &(*curr)->snext) {
+        if (*curr == ticker) {
+            *curr = ticker->snext;
+            break;
+        }
+    }
 
-    while (nconns > 0) {
-        if (!yar_portspec_next(ticker->portspec, &port)) {
-            if (!yar_addrspec_next(ticker->addrspec, &ticker->curr_addr)) {
-                ticker->flags |= CONNECT_TICKER_FLG_FINISHED_DISPATCHING;
-                return;
-            } else {
-                yar_portspec_reset(ticker->portspec);
-                continue;
+    if (_sched.next == ticker) {
+        _sched.next = ticker->snext;
+    }
+}
+
+static void yar_connect_ticker_free(void *data)
+{
+    struct yar_connect_ticker *ticker = data, **curr;
+    if (ticker != NULL) {
+        for (curr = &_jobs; *curr != NULL; curr = &(*curr)->jnext) {
+            if (*curr == ticker) {
+                *curr = ticker->jnext;
+                break;
             }
         }
 
-        ep = malloc(sizeof(*ep));
-        if (!ep) {
-            break;
+        if (ticker->flags & CONNECT_TICKER_FLG_SCHEDULED) {
+            yar_sched_remove(ticker);
         }
 
-        yar_addr_copy(&ep->addr, &ticker->curr_addr);
-        ep->port = port;
-        ep->handle = NULL;
-        
-        if (cli->proto == ADDRPROTO_UDP) {
-            fd = socket(ticker->curr_addr.af, SOCK_DGRAM, 
-                    IPPROTO_UDP);
-        } else {
-            fd = socket(ticker->curr_addr.af, SOCK_STREAM, 
-                    IPPROTO_TCP);
+        if (ticker->addrspec != NULL) {
+            yar_addrspec_free(ticker->addrspec);
         }
 
-        evutil_make_socket_nonblocking(fd);
-        bev = bufferevent_socket_new(_evbase, fd, 
-                BEV_OPT_CLOSE_ON_FREE);
-        if (cli->on_read != NULL) {
-            on_read = yar_client_on_read;
-        } else {
-            on_read = NULL;
+        if (ticker->portspec != NULL) {
+            yar_portspec_free(ticker->portspec);
         }
 
-        ep->handle = yar_endpoint_handle_new(ticker, bev);
-        bufferevent_setcb(bev, on_read, NULL, yar_client_on_event, ep);
-        if (cli->to > 0) {
-            tv.tv_sec = cli->to  / 1000000;
-            tv.tv_usec = cli->to % 1000000;
-            bufferevent_set_timeouts(bev, &tv, &tv);
+        if (ticker->ev != NULL) {
+            event_free(ticker->ev);
         }
 
-        if (on_read == NULL) {
-            bufferevent_enable(bev, EV_WRITE);
-        } else {
-            bufferevent_enable(bev, EV_WRITE|EV_READ);
+        if (ticker->udp != NULL) {
+            yar_udp_free(ticker->udp);
         }
 
-        nconns--;
-        ticker->ncurrent++;
-        yar_addr_copy_to_storage(&ticker->curr_addr, 
-                (unsigned short)port, &ss, &sslen);
-        if (bufferevent_socket_connect(bev, (struct sockaddr *)&ss, 
-                    sslen) < 0) { 
-            /* unable to initiate connection attempt
-               error should be handled by yar_client_on_event */
-            continue;
+        free(ticker);
+        if (--_njobs == 0) {
+            yar_pool_clear();
+        }
+    }
+}
+
+/* microseconds from dispatch to t */
+static uint64_t yar_endpoint_elapsed(const struct yar_endpoint_handle *eph,
+        uint64_t t)
+{
+    return t > eph->times.dispatch ? t - eph->times.dispatch : 0;
+}
+
+/* add an RTT sample for an endpoint that got an answer at t */
+static void yar_endpoint_sample_rtt(struct yar_endpoint_handle *eph,
+        uint64_t t)
+{
+    struct yar_client *cli = eph->ticker->cli;
+    uint64_t usec;
+
+    if (cli->rtt != NULL) {
+        usec = yar_endpoint_elapsed(eph, t);
+        yar_rtt_sample(cli->rtt, &eph->ep->addr, 
+                usec > UINT_MAX ? UINT_MAX : (unsigned int)usec);
+    }
+}
+
+static void yar_job_count(struct yar_job_summary *sum, unsigned int status,
+        int err)
+{
+    switch (status) {
+    case RLOG_STATUS_ESTABLISHED:
+        sum->established++;
+        break;
+    case RLOG_STATUS_EOF:
+        sum->eof++;
+        break;
+    case RLOG_STATUS_TIMEOUT:
+        sum->timedout++;
+        break;
+    case RLOG_STATUS_ERROR:
+        sum->errors++;
+        if (err == ECONNREFUSED) {
+            sum->refused++;
+        }
+
+        break;
+    }
+}
+
+static void yar_endpoint_count(struct yar_client *cli, unsigned int status,
+        int err)
+{
+    switch (status) {
+    case RLOG_STATUS_ESTABLISHED:
+        METRICS_ADD(cli, established, 1);
+        break;
+    case RLOG_STATUS_READ:
+        METRICS_ADD(cli, messages, 1);
+        break;
+    case RLOG_STATUS_EOF:
+        METRICS_ADD(cli, eof, 1);
+        break;
+    case RLOG_STATUS_TIMEOUT:
+        METRICS_ADD(cli, timedout, 1);
+        break;
+    case RLOG_STATUS_ERROR:
+        METRICS_ADD(cli, errors, 1);
+        METRICS_ADD(cli, errnos[err > 0 && err < METRICS_NERRNO ? err : 0], 
+                1);
+        if (err == ECONNREFUSED) {
+            METRICS_ADD(cli, refused, 1);
+        }
+
+        break;
+    }
+}
+
+/**
+ * yar_endpoint_outcome --
+ *     count an outcome in the metrics and append a record to cli->rlog, 
+ *     if set. The payload, if any, is the first len bytes of evb. 
+ *     Endpoints without a handle were never dispatched, so their elapsed
+ *     time is zero
+ */
+static void yar_endpoint_outcome(struct yar_client *cli, 
+        struct yar_endpoint *ep, unsigned int status, int err, 
+        struct evbuffer *evb, size_t len)
+{
+    struct yar_rlog_rec rec;
+    struct sockaddr_storage ss;
+    socklen_t sslen;
+    struct timeval start;
+    uint64_t now, usec = 0;
+    size_t maxpayload;
+    void *payload;
+
+    now = yar_now_us();
+    if (ep->handle != NULL) {
+        if (status == RLOG_STATUS_ESTABLISHED) {
+            ep->handle->times.connect = now;
+        } else if (status != RLOG_STATUS_READ) {
+            ep->handle->times.close = now;
+        }
+
+        /* the estimate was too short, or the prefix has gone quiet */
+        if (status == RLOG_STATUS_TIMEOUT && cli->rtt != NULL &&
+                (ep->handle->flags & EPH_FLG_RTT_CTO) &&
+                !(ep->handle->flags & 
+                (EPH_FLG_ESTABLISHED|EPH_FLG_GOT_INPUT))) {
+            yar_rtt_backoff(cli->rtt, &ep->addr);
         }
+
+        usec = yar_endpoint_elapsed(ep->handle, now);
+    }
+
+    yar_endpoint_count(cli, status, err);
+    if (ep->handle != NULL && ep->handle->ticker != NULL) {
+        yar_job_count(&ep->handle->ticker->sum, status, err);
+    }
+
+    if (cli->rlog == NULL) {
+        return;
+    }
+
+    if (ep->handle != NULL) {
+        start = ep->handle->tstart;
+    } else {
+        evutil_gettimeofday(&start, NULL);
+    }
+
+    memset(&rec, 0, sizeof(rec));
+    yar_addr_copy_to_storage(&ep->addr, (unsigned short)ep->port, &ss, 
+            &sslen);
+    yar_rlog_rec_set_addr(&rec, (struct sockaddr *)&ss);
+    rec.status = (uint8_t)status;
+    rec.err = err;
+    rec.ts = (uint64_t)start.tv_sec * 1000000 + (uint64_t)start.tv_usec;
+    rec.elapsed = usec > UINT32_MAX ? UINT32_MAX : (uint32_t)usec;
+    maxpayload = yar_rlog_maxpayload(cli->rlog);
+    if (evb != NULL) {
+        rec.paylen = (uint16_t)(len < maxpayload ? len : maxpayload);
+    }
+
+    payload = yar_rlog_reserve(cli->rlog, &rec);
+    if (payload != NULL && rec.paylen > 0) {
+        evbuffer_copyout(evb, payload, rec.paylen);
+    }
+}
+
+/* total deadline, or response timeout of a datagram endpoint */
+static void yar_endpoint_on_timeout(evutil_socket_t fd, short what, 
+        void *ctx)
+{
+    struct yar_endpoint *ep = ctx;
+    struct yar_client *cli;
+
+    assert(ep != NULL);
+    assert(ep->handle != NULL);
+
+    cli = ep->handle->ticker->cli;
+    assert(cli != NULL);
+
+    yar_endpoint_outcome(cli, ep, RLOG_STATUS_TIMEOUT, 0, NULL, 0);
+    if (cli->on_timeout != NULL) {
+        yar_endpoint_call(cli->on_timeout, CBTYPE_TIMEOUT, ep);
+    }
+
+    if (ep->handle != NULL) {
+        yar_endpoint_handle_free(&ep->handle);
+    }
+
+    free(ep);
+}
+
+/* report an error to on_error and close the endpoint. ep is freed */
+static void yar_endpoint_fail(struct yar_endpoint *ep, int err)
+{
+    struct yar_client *cli = ep->handle->ticker->cli;
+
+    yar_endpoint_outcome(cli, ep, RLOG_STATUS_ERROR, err, NULL, 0);
+    if (cli->on_error != NULL) {
+        errno = err;
+        yar_endpoint_call(cli->on_error, CBTYPE_ERROR, ep);
+    }
+
+    if (ep->handle != NULL) {
+        yar_endpoint_handle_free(&ep->handle);
+    }
+
+    free(ep);
+}
+
+static struct evbuffer *yar_endpoint_input(struct yar_endpoint_handle *eph)
+{
+    return eph->bev != NULL ? bufferevent_get_input(eph->bev) : eph->input;
+}
+
+static void yar_endpoint_send_request(struct yar_endpoint_handle *eph)
+{
+    struct yar_request *req;
+
+    req = eph->reqhead;
+    eph->reqhead = req->next;
+    if (eph->reqhead == NULL) {
+        eph->reqtail = &eph->reqhead;
+    }
+
+    eph->nqueued--;
+    eph->nsent++;
+    if (req->payload != NULL) {
+        yar_endpoint_write_payload(eph, req->payload);
+        yar_payload_unref(req->payload);
+    } else {
+        yar_endpoint_write(eph, req->data, req->len);
+    }
+
+    free(req);
+}
+
+/* a response was passed to on_read, send the next request, if any */
+static void yar_endpoint_request_done(struct yar_endpoint_handle *eph)
+{
+    if (eph->nsent > 0) {
+        eph->nsent--;
+    }
+
+    if (eph->nsent == 0 && eph->reqhead != NULL) {
+        yar_endpoint_send_request(eph);
+    }
+}
+
+#define RVALIDATE_NVEC 8
+
+/* templates that render to at most this many bytes, and iovecs of at 
+   most this many bytes in total, are gathered on the stack for datagram
+   endpoints */
+#define TMPL_STACKBUF 512
+#define WRITEV_STACKBUF 512
+
+/* initial size of an endpoint's list of matched pattern IDs */
+#define ENDPOINT_INITIAL_MATCHES 4
+
+/**
+ * yar_endpoint_validate_inc --
+ *     run the incremental read validator over the part of the input that
+ *     it has not seen yet, one segment at a time, without making the
+ *     input contiguous
+ */
+static int yar_endpoint_validate_inc(struct yar_endpoint_handle *eph,
+        struct evbuffer *evb, size_t len)
+{
+    yar_read_validator_inc validator = eph->ticker->cli->read_validator_inc;
+    struct yar_rvstate *st = &eph->rvs;
+    struct evbuffer_iovec vec[RVALIDATE_NVEC];
+    struct evbuffer_ptr ptr;
+    int i, n, ret;
+
+    while (st->off < len) {
+        if (evbuffer_ptr_set(evb, &ptr, st->off, EVBUFFER_PTR_SET) < 0) {
+            return RVALIDATOR_INCORRECT;
+        }
+
+        n = evbuffer_peek(evb, -1, &ptr, vec, RVALIDATE_NVEC);
+        if (n <= 0) {
+            break;
+        } else if (n > RVALIDATE_NVEC) {
+            n = RVALIDATE_NVEC;
+        }
+
+        for (i = 0; i < n; i++) {
+            st->arg = eph->ticker->cli->read_validator_arg;
+            ret = validator(st, vec[i].iov_base, vec[i].iov_len);
+            if (ret != RVALIDATOR_INCOMPLETE) {
+                return ret;
+            }
+
+            st->off += vec[i].iov_len;
+        }
+    }
+
+    return RVALIDATOR_INCOMPLETE;
+}
+
+/* records each pattern ID matched on an endpoint once */
+static void yar_endpoint_on_match(unsigned int id, size_t end, void *data)
+{
+    struct yar_endpoint_handle *eph = data;
+    unsigned int *tmp;
+    size_t i, newcap;
+
+    for (i = 0; i < eph->nmatches; i++) {
+        if (eph->matches[i] == id) {
+            return;
+        }
+    }
+
+    if (eph->nmatches == eph->matchcap) {
+        newcap = eph->matchcap == 0 ? ENDPOINT_INITIAL_MATCHES : 
+                eph->matchcap * 2;
+        tmp = realloc(eph->matches, newcap * sizeof(*tmp));
+        if (tmp == NULL) {
+            return;
+        }
+
+        eph->matches = tmp;
+        eph->matchcap = newcap;
+    }
+
+    eph->matches[eph->nmatches++] = id;
+}
+
+/**
+ * yar_endpoint_scan --
+ *     run the client's matcher over the part of the input that it has not
+ *     seen yet, one segment at a time
+ */
+static void yar_endpoint_scan(struct yar_endpoint_handle *eph,
+        struct evbuffer *evb, size_t len)
+{
+    const yar_matcher_t *m = eph->ticker->cli->matcher;
+    struct evbuffer_iovec vec[RVALIDATE_NVEC];
+    struct evbuffer_ptr ptr;
+    int i, n;
+
+    while (eph->mscanned < len) {
+        if (evbuffer_ptr_set(evb, &ptr, eph->mscanned, EVBUFFER_PTR_SET) < 0) {
+            break;
+        }
+
+        n = evbuffer_peek(evb, -1, &ptr, vec, RVALIDATE_NVEC);
+        if (n <= 0) {
+            break;
+        } else if (n > RVALIDATE_NVEC) {
+            n = RVALIDATE_NVEC;
+        }
+
+        for (i = 0; i < n; i++) {
+            eph->mstate = yar_matcher_scan(m, eph->mstate, vec[i].iov_base,
+                    vec[i].iov_len, yar_endpoint_on_match, eph);
+            eph->mscanned += vec[i].iov_len;
+        }
+    }
+}
+
+/* keeps track of how much of the input has been scanned */
+static void yar_endpoint_drained(struct yar_endpoint_handle *eph, size_t n)
+{
+    eph->mscanned = eph->mscanned > n ? eph->mscanned - n : 0;
+    eph->incounted = eph->incounted > n ? eph->incounted - n : 0;
+}
+
+/* count input that arrived since the last call */
+static void yar_endpoint_count_input(struct yar_endpoint_handle *eph,
+        struct evbuffer *evb)
+{
+    struct yar_client *cli = eph->ticker->cli;
+    uint64_t usec;
+    size_t len;
+
+    len = evbuffer_get_length(evb);
+    if (len <= eph->incounted) {
+        return;
+    }
+
+    METRICS_ADD(cli, bytes_in, len - eph->incounted);
+    eph->incounted = len;
+    eph->times.last_read = yar_now_us();
+    if (!(eph->flags & EPH_FLG_GOT_INPUT)) {
+        eph->flags |= EPH_FLG_GOT_INPUT;
+        eph->times.first_read = eph->times.last_read;
+        usec = yar_endpoint_elapsed(eph, eph->times.first_read);
+        yar_hist_record(&_metrics.ttfb_us, usec);
+        if (cli->metrics != NULL) {
+            yar_hist_record(&cli->metrics->ttfb_us, usec);
+        }
+    }
+}
+
+/**
+ * yar_endpoint_process_input --
+ *     validate the endpoint's input buffer and pass it to the on_read
+ *     handler. With CLIENT_FLG_PARTIAL_CONSUME, this is repeated for as 
+ *     long as the handler consumes input. ep is freed if the endpoint is 
+ *     terminated
+ */
+static void yar_endpoint_process_input(struct yar_endpoint *ep)
+{
+    struct yar_client *cli;
+    struct evbuffer *evb;
+    size_t len;
+    unsigned char *data = NULL;
+    int ret;
+
+    assert(ep != NULL);
+    assert(ep->handle != NULL);
+
+    cli = ep->handle->ticker->cli;
+    assert(cli != NULL);
+
+    evb = yar_endpoint_input(ep->handle);
+    yar_endpoint_count_input(ep->handle, evb);
+    if (cli->matcher != NULL) {
+        yar_endpoint_scan(ep->handle, evb, evbuffer_get_length(evb));
+    }
+
+    while ((len = evbuffer_get_length(evb)) > 0) {
+        if (cli->read_validator_inc != NULL) {
+            ret = yar_endpoint_validate_inc(ep->handle, evb, len);
+        } else if (cli->read_validator != NULL) {
+            data = evbuffer_pullup(evb, len);
+            ret = cli->read_validator(data, len);
+        } else {
+            ret = RVALIDATOR_OK;
+        }
+
+        if (ret == RVALIDATOR_INCORRECT) {
+            yar_endpoint_handle_free(&ep->handle);
+            free(ep);
+            return;
+        } else if (ret == RVALIDATOR_INCOMPLETE) {
+            if (cli->rbufmax == 0 || len < cli->rbufmax) {
+                return;
+            } else if (cli->rbufpolicy != RBUFPOLICY_TRUNCATE) {
+                /* the message will never fit */
+                yar_endpoint_fail(ep, EMSGSIZE);
+                return;
+            }
+
+            /* the input is full, deliver what we have */
+        }
+
+        ep->handle->consumed = 0;
+        yar_endpoint_outcome(cli, ep, RLOG_STATUS_READ, 0, evb, 
+                yar_endpoint_msglen(ep->handle));
+
+        yar_endpoint_call(cli->on_read, CBTYPE_READ, ep);
+        if (ep->handle == NULL) {
+            free(ep);
+            return;
+        }
+
+        memset(&ep->handle->rvs, 0, sizeof(ep->handle->rvs));
+        if (!(cli->flags & CLIENT_FLG_PARTIAL_CONSUME)) {
+            if (ep->handle->consumed < len) {
+                evbuffer_drain(evb, len - ep->handle->consumed);
+                yar_endpoint_drained(ep->handle, len - ep->handle->consumed);
+            }
+
+            yar_endpoint_request_done(ep->handle);
+            return;
+        } else if (ep->handle->consumed == 0) {
+            /* the handler wants more data, or consumes it later. Reading
+               is suspended while the input is full */
+            if (cli->rbufmax > 0 && len >= cli->rbufmax &&
+                    cli->rbufpolicy == RBUFPOLICY_TERMINATE) {
+                yar_endpoint_fail(ep, EMSGSIZE);
+            }
+
+            return;
+        }
+
+        /* keep the rest, it may hold the next message */
+        yar_endpoint_request_done(ep->handle);
+    }
+}
+
+static void yar_client_on_read(struct bufferevent *bev, void *ctx)
+{
+    struct yar_endpoint *ep = ctx;
+
+    assert(ep != NULL);
+    assert(ep->handle != NULL);
+    
+    if (ep->handle->bev == NULL) {
+        ep->handle->bev = bev;
+    }
+    
+    yar_endpoint_process_input(ep);
+}
+
+/* the output buffer has been written to the socket */
+static void yar_client_on_write(struct bufferevent *bev, void *ctx)
+{
+    struct yar_endpoint *ep = ctx;
+    struct yar_endpoint_handle *eph;
+    struct yar_client *cli;
+
+    assert(ep != NULL);
+    assert(ep->handle != NULL);
+
+    if (ep->handle->bev == NULL) {
+        ep->handle->bev = bev;
+    }
+
+    cli = ep->handle->ticker->cli;
+    if (cli->on_write_drained != NULL) {
+        yar_endpoint_call(cli->on_write_drained, CBTYPE_WRITE_DRAINED, ep);
+        if (ep->handle == NULL) {
+            free(ep);
+            return;
+        }
+    }
+
+    /* the handler may have written more */
+    eph = ep->handle;
+    if ((cli->flags & CLIENT_FLG_SHUTDOWN_WR) && 
+            !(eph->flags & EPH_FLG_SHUTDOWN_WR) && eph->nqueued == 0 &&
+            evbuffer_get_length(bufferevent_get_output(bev)) == 0) {
+        shutdown(bufferevent_getfd(bev), SHUT_WR);
+        eph->flags |= EPH_FLG_SHUTDOWN_WR;
+    }
+}
+
+/* the write callback is only set when there is something to do */
+static bufferevent_data_cb yar_client_write_cb(const struct yar_client *cli)
+{
+    if (cli->on_write_drained != NULL || 
+            (cli->flags & CLIENT_FLG_SHUTDOWN_WR)) {
+        return yar_client_on_write;
+    }
+
+    return NULL;
+}
+
+/**
+ * yar_endpoint_connected --
+ *     a new connection has been established. ep is freed if the endpoint
+ *     is terminated by on_established
+ */
+static void yar_endpoint_connected(struct yar_endpoint *ep)
+{
+    struct yar_client *cli = ep->handle->ticker->cli;
+    uint64_t usec;
+
+    ep->handle->flags |= EPH_FLG_ESTABLISHED;
+    yar_endpoint_outcome(cli, ep, RLOG_STATUS_ESTABLISHED, 0, NULL, 0);
+    yar_endpoint_sample_rtt(ep->handle, ep->handle->times.connect);
+    usec = yar_endpoint_elapsed(ep->handle, ep->handle->times.connect);
+    yar_hist_record(&_metrics.connect_us, usec);
+    if (cli->metrics != NULL) {
+        yar_hist_record(&cli->metrics->connect_us, usec);
+    }
+
+    if (cli->on_established != NULL) {
+        yar_endpoint_call(cli->on_established, CBTYPE_ESTABLISHED, ep);
+
+        if (ep->handle == NULL) {
+            free(ep);
+        }
+    }
+}
+
+static void yar_client_on_event(struct bufferevent *bev, short events, 
+        void *ctx)
+{
+    struct yar_endpoint *ep = ctx;
+    struct yar_client *cli;
+    int err;
+
+    assert(ep != NULL);
+    assert(ep->handle != NULL);
+    
+    if (ep->handle->bev == NULL) {
+        ep->handle->bev = bev;
+    }
+
+    cli = ep->handle->ticker->cli;
+    assert(cli != NULL);
+    
+    if (events & (BEV_EVENT_ERROR|BEV_EVENT_EOF|BEV_EVENT_TIMEOUT)) {
+        if (events & BEV_EVENT_ERROR) {
+            err = EVUTIL_SOCKET_ERROR();
+            yar_endpoint_outcome(cli, ep, RLOG_STATUS_ERROR, err, NULL, 0);
+            if (err == ECONNREFUSED && 
+                    !(ep->handle->flags & EPH_FLG_ESTABLISHED)) {
+                /* a reset is an answer too */
+                yar_endpoint_sample_rtt(ep->handle, ep->handle->times.close);
+            }
+
+            EVUTIL_SET_SOCKET_ERROR(err);
+        } else {
+            yar_endpoint_outcome(cli, ep, (events & BEV_EVENT_EOF) ? 
+                    RLOG_STATUS_EOF : RLOG_STATUS_TIMEOUT, 0, NULL, 0);
+        }
+
+        if (cli->on_error != NULL && events & BEV_EVENT_ERROR) {
+            yar_endpoint_call(cli->on_error, CBTYPE_ERROR, ep);
+        } else if (cli->on_eof != NULL && events & BEV_EVENT_EOF) {
+            yar_endpoint_call(cli->on_eof, CBTYPE_EOF, ep);
+        } else if (cli->on_timeout != NULL && events & BEV_EVENT_TIMEOUT) {
+            yar_endpoint_call(cli->on_timeout, CBTYPE_TIMEOUT, ep);
+        }
+        
+        if (ep->handle != NULL) {
+            yar_endpoint_handle_free(&ep->handle);
+        }
+
+        free(ep);
+    } else if (events & BEV_EVENT_CONNECTED) {
+        yar_endpoint_set_io_timeouts(ep->handle);
+        yar_endpoint_connected(ep);
+    }
+}
+
+/* report a datagram that could not be sent to its endpoint, if alive */
+static void yar_udp_report_error(struct yar_connect_ticker *ticker,
+        const struct sockaddr *sa, int err)
+{
+    struct yar_endpoint_handle *eph;
+
+    eph = yar_ephash_lookup(&ticker->udp->ephash, sa, yar_ephash_sum(sa));
+    if (eph != NULL) {
+        yar_endpoint_fail(eph->ep, err);
+    }
+}
+
+static void yar_udp_sock_flush(struct yar_udp_sock *us)
+{
+    struct mmsghdr msgs[UDP_BATCH];
+    struct iovec iov[UDP_BATCH];
+    struct sockaddr_storage failed[UDP_BATCH];
+    int errs[UDP_BATCH];
+    struct yar_udp_dgram *dgram;
+    size_t i, n, sent = 0, nfailed = 0;
+    int ret;
+
+    /* failures are collected for at most one batch, the rest of the queue
+       waits for the next write event */
+    while (sent < us->npending && nfailed < UDP_BATCH) {
+        n = us->npending - sent;
+        if (n > UDP_BATCH) {
+            n = UDP_BATCH;
+        }
+
+        memset(msgs, 0, sizeof(*msgs) * n);
+        for (i = 0; i < n; i++) {
+            dgram = &us->pending[sent+i];
+            iov[i].iov_base = us->buf + dgram->off;
+            iov[i].iov_len = dgram->len;
+            msgs[i].msg_hdr.msg_name = &dgram->ss;
+            msgs[i].msg_hdr.msg_namelen = dgram->sslen;
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        ret = sendmmsg(us->fd, msgs, (unsigned int)n, 0);
+        if (ret < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                break;
+            }
+
+            /* the first datagram in the batch failed, skip it. Its 
+               endpoint is notified when the send queue is consistent */
+            memcpy(&failed[nfailed], &us->pending[sent].ss, 
+                    sizeof(struct sockaddr_storage));
+            errs[nfailed++] = errno;
+            sent++;
+        } else {
+            sent += (size_t)ret;
+        }
+    }
+
+    for (i = 0; i < sent; i++) {
+        _membuffered -= us->pending[i].len;
+    }
+
+    if (sent == us->npending) {
+        us->npending = 0;
+        us->buflen = 0;
+    } else {
+        memmove(us->pending, us->pending + sent, 
+                (us->npending - sent) * sizeof(*us->pending));
+        us->npending -= sent;
+        event_add(us->wev, NULL);
+    }
+
+    for (i = 0; i < nfailed; i++) {
+        yar_udp_report_error(us->ticker, (struct sockaddr *)&failed[i],
+                errs[i]);
+    }
+}
+
+static void yar_udp_on_writable(evutil_socket_t fd, short what, void *ctx)
+{
+    yar_udp_sock_flush(ctx);
+}
+
+static int yar_udp_sock_queue(struct yar_udp_sock *us, 
+        const struct sockaddr_storage *ss, socklen_t sslen,
+        const void *data, size_t len)
+{
+    struct yar_udp_dgram *dgram;
+    unsigned char *buf;
+    size_t size;
+
+    if (us->npending == us->maxpending) {
+        size = us->maxpending > 0 ? us->maxpending * 2 : UDP_BATCH;
+        dgram = realloc(us->pending, size * sizeof(*dgram));
+        if (dgram == NULL) {
+            return -1;
+        }
+
+        us->pending = dgram;
+        us->maxpending = size;
+    }
+
+    if (us->bufsize - us->buflen < len) {
+        size = us->bufsize > 0 ? us->bufsize : UDP_BATCH * 512;
+        while (size - us->buflen < len) {
+            size *= 2;
+        }
+
+        buf = realloc(us->buf, size);
+        if (buf == NULL) {
+            return -1;
+        }
+
+        us->buf = buf;
+        us->bufsize = size;
+    }
+
+    dgram = &us->pending[us->npending++];
+    memcpy(&dgram->ss, ss, sslen);
+    dgram->sslen = sslen;
+    dgram->off = us->buflen;
+    dgram->len = len;
+    memcpy(us->buf + us->buflen, data, len);
+    us->buflen += len;
+    _membuffered += len;
+
+    /* the batch is sent once control returns to the event loop, never from
+       here: a failed send fails its endpoint, which may be the caller's */
+    if (us->npending == UDP_BATCH) {
+        event_active(us->wev, EV_WRITE, 1);
+    } else if (us->npending == 1) {
+        event_add(us->wev, NULL);
+    }
+
+    return 0;
+}
+
+static void yar_udp_deliver(struct yar_connect_ticker *ticker,
+        const struct sockaddr *sa, const void *data, size_t len)
+{
+    struct yar_endpoint_handle *eph;
+    size_t curr;
+
+    eph = yar_ephash_lookup(&ticker->udp->ephash, sa, yar_ephash_sum(sa));
+    if (eph == NULL) {
+        /* late or unsolicited */
+        return;
+    }
+
+    /* a datagram endpoint is established by its first response */
+    if (!(eph->flags & EPH_FLG_ESTABLISHED)) {
+        eph->flags |= EPH_FLG_ESTABLISHED;
+        yar_endpoint_outcome(ticker->cli, eph->ep, RLOG_STATUS_ESTABLISHED, 
+                0, NULL, 0);
+        yar_endpoint_sample_rtt(eph, eph->times.connect);
+    }
+
+    if (eph->input == NULL) {
+        /* unwanted */
+        return;
+    }
+
+    /* the response timeout becomes an idle timeout after the first 
+       datagram */
+    if (ticker->to.read != NULL) {
+        evtimer_add(eph->timer, ticker->to.read);
+    } else {
+        evtimer_del(eph->timer);
+    }
+
+    if (ticker->cli->rbufmax > 0) {
+        /* there is no way to push back on a datagram, drop the excess */
+        curr = evbuffer_get_length(eph->input);
+        if (curr >= ticker->cli->rbufmax) {
+            len = 0;
+        } else if (len > ticker->cli->rbufmax - curr) {
+            len = ticker->cli->rbufmax - curr;
+        }
+    }
+
+    evbuffer_add(eph->input, data, len);
+    yar_endpoint_process_input(eph->ep);
+}
+
+static void yar_udp_on_readable(evutil_socket_t fd, short what, void *ctx)
+{
+    struct yar_udp_sock *us = ctx;
+    struct yar_udp_rx *rx = us->ticker->udp->rx;
+    int i, n, round;
+
+    for (round = 0; round < UDP_RX_ROUNDS; round++) {
+        for (i = 0; i < UDP_BATCH; i++) {
+            rx->msgs[i].msg_hdr.msg_namelen = 
+                    sizeof(struct sockaddr_storage);
+        }
+
+        n = recvmmsg(fd, rx->msgs, UDP_BATCH, MSG_DONTWAIT, NULL);
+        if (n <= 0) {
+            break;
+        }
+
+        for (i = 0; i < n; i++) {
+            yar_udp_deliver(us->ticker, (struct sockaddr *)&rx->addrs[i], 
+                    rx->bufs[i], rx->msgs[i].msg_len);
+        }
+
+        if (n < UDP_BATCH) {
+            break;
+        }
+    }
+}
+
+static int yar_udp_sock_init(struct yar_udp_sock *us, 
+        struct yar_connect_ticker *ticker, int af)
+{
+    int bufsize = UDP_SOCKBUF;
+
+    memset(us, 0, sizeof(*us));
+    us->ticker = ticker;
+    us->fd = socket(af, SOCK_DGRAM, IPPROTO_UDP);
+    if (us->fd < 0) {
+        return -1;
+    }
+
+    evutil_make_socket_nonblocking(us->fd);
+    setsockopt(us->fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+    setsockopt(us->fd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+    us->rev = event_new(_evbase, us->fd, EV_READ|EV_PERSIST, 
+            yar_udp_on_readable, us);
+    us->wev = event_new(_evbase, us->fd, EV_WRITE, yar_udp_on_writable, us);
+    if (us->rev == NULL || us->wev == NULL) {
+        yar_udp_sock_cleanup(us);
+        return -1;
+    }
+
+    event_add(us->rev, NULL);
+    return 0;
+}
+
+static struct yar_udp_sock *yar_udp_get_sock(
+        struct yar_connect_ticker *ticker, int af, uint32_t hkey)
+{
+    struct yar_udp *udp = ticker->udp;
+    struct yar_udp_sock **socks;
+    unsigned int i;
+
+    if (udp->rx == NULL && (udp->rx = yar_udp_rx_new()) == NULL) {
+        return NULL;
+    }
+
+    socks = (af == AF_INET) ? &udp->socks4 : &udp->socks6;
+    if (*socks == NULL) {
+        *socks = calloc(udp->nsocks, sizeof(**socks));
+        if (*socks == NULL) {
+            return NULL;
+        }
+
+        for (i = 0; i < udp->nsocks; i++) {
+            if (yar_udp_sock_init(&(*socks)[i], ticker, af) < 0) {
+                while (i-- > 0) {
+                    yar_udp_sock_cleanup(&(*socks)[i]);
+                }
+
+                free(*socks);
+                *socks = NULL;
+                return NULL;
+            }
+        }
+    }
+
+    return &(*socks)[hkey % udp->nsocks];
+}
+
+static struct yar_endpoint_handle *yar_udp_endpoint_new(
+        struct yar_connect_ticker *ticker, struct yar_endpoint *ep,
+        const struct sockaddr_storage *ss)
+{
+    struct yar_endpoint_handle *eph;
+    uint32_t hkey;
+
+    hkey = yar_ephash_sum((const struct sockaddr *)ss);
+    if (yar_ephash_lookup(&ticker->udp->ephash, (const struct sockaddr *)ss,
+            hkey) != NULL) {
+        /* responses could not be told apart */
+        errno = EEXIST;
+        return NULL;
+    }
+
+    eph = yar_endpoint_handle_new(ticker, ep, NULL);
+    if (eph == NULL) {
+        return NULL;
+    }
+
+    eph->hkey = hkey;
+    eph->usock = yar_udp_get_sock(ticker, ep->addr.af, hkey);
+    eph->timer = evtimer_new(_evbase, yar_endpoint_on_timeout, ep);
+    if (ticker->cli->on_read != NULL) {
+        eph->input = evbuffer_new();
+    }
+
+    if (eph->usock == NULL || eph->timer == NULL || 
+            (ticker->cli->on_read != NULL && eph->input == NULL) ||
+            yar_ephash_insert(&ticker->udp->ephash, eph) < 0) {
+        eph->usock = NULL;
+        yar_endpoint_handle_free(&eph);
+        return NULL;
+    }
+
+    if (ticker->to.connect != NULL) {
+        evtimer_add(eph->timer, yar_connect_timeout(ticker, eph));
+    }
+
+    if (_membudget > 0) {
+        yar_endpoint_track_memory(eph);
+    }
+
+    return eph;
+}
+
+static uint64_t yar_tv_ns(const struct timeval *tv)
+{
+    return (uint64_t)tv->tv_sec * NSEC_PER_SEC + 
+            (uint64_t)tv->tv_usec * 1000;
+}
+
+/* the connect timeout of a simulated endpoint, in nanoseconds */
+static uint64_t yar_sim_connect_timeout(struct yar_connect_ticker *ticker,
+        struct yar_endpoint_handle *eph)
+{
+    const struct timeval *tv;
+    unsigned int i;
+
+    /* common timeouts are encoded, use the plain copies */
+    tv = yar_connect_timeout(ticker, eph);
+    if (ticker->cli->rtt != NULL) {
+        for (i = 0; i < RTT_NSTEPS; i++) {
+            if (tv == ticker->rttto[i]) {
+                return yar_tv_ns(&ticker->rttfallback[i]);
+            }
+        }
+    }
+
+    return yar_tv_ns(&ticker->to.fallback[0]);
+}
+
+/* restart the idle read timeout, like a bufferevent does on input */
+static void yar_sim_arm_read_timeout(struct yar_endpoint_handle *eph)
+{
+    struct yar_connect_ticker *ticker = eph->ticker;
+
+    if (ticker->cli->on_read != NULL && ticker->to.read != NULL) {
+        yar_sim_timer_add_common(_sim, &eph->sim->timeout, 
+                yar_tv_ns(&ticker->to.fallback[1]));
+    } else {
+        yar_sim_timer_del(_sim, &eph->sim->timeout);
+    }
+}
+
+static void yar_sim_on_timeout(void *arg)
+{
+    yar_endpoint_on_timeout(-1, EV_TIMEOUT, arg);
+}
+
+/* append a response of len bytes, ending with an empty line */
+static int yar_sim_response(struct evbuffer *evb, size_t len)
+{
+    static const char end[] = "\r\n\r\n";
+    struct evbuffer_iovec vec;
+    size_t n;
+
+    if (len == 0) {
+        return 0;
+    } else if (evbuffer_reserve_space(evb, (ev_ssize_t)len, &vec, 1) != 1) {
+        return -1;
+    }
+
+    n = len < sizeof(end) - 1 ? len : sizeof(end) - 1;
+    memset(vec.iov_base, 'x', len - n);
+    memcpy((char *)vec.iov_base + len - n, end + sizeof(end) - 1 - n, n);
+    vec.iov_len = len;
+    return evbuffer_commit_space(evb, &vec, 1);
+}
+
+/* the next network event of a simulated connection */
+static void yar_sim_on_net(void *arg)
+{
+    struct yar_endpoint *ep = arg;
+    struct yar_endpoint_handle *eph = ep->handle;
+    struct yar_sim_conn *sc = eph->sim;
+    struct yar_client *cli = eph->ticker->cli;
+    uint64_t rtt = (uint64_t)sc->target.rtt_us * 1000;
+
+    switch (sc->state) {
+    case SIM_CONN_CONNECTING:
+        if (sc->target.outcome == SIM_REFUSE) {
+            yar_endpoint_sample_rtt(eph, yar_now_us());
+            yar_endpoint_fail(ep, ECONNREFUSED);
+            return;
+        }
+
+        sc->state = SIM_CONN_WAITING;
+        yar_sim_arm_read_timeout(eph);
+        if ((yar_sim_flags(_sim) & SIM_FLG_BANNER) && 
+                sc->target.resp_len > 0) {
+            sc->state = SIM_CONN_RESPONDING;
+            yar_sim_timer_add(_sim, &sc->net, rtt);
+        }
+
+        yar_endpoint_connected(ep);
+        break;
+    case SIM_CONN_RESPONDING:
+        sc->state = SIM_CONN_WAITING;
+        if (yar_sim_flags(_sim) & SIM_FLG_CLOSE) {
+            sc->state = SIM_CONN_CLOSING;
+            yar_sim_timer_add(_sim, &sc->net, 0);
+        }
+
+        yar_sim_arm_read_timeout(eph);
+        if (eph->input != NULL) {
+            if (yar_sim_response(eph->input, sc->target.resp_len) < 0) {
+                yar_endpoint_fail(ep, ENOMEM);
+                return;
+            }
+
+            yar_endpoint_process_input(ep);
+        }
+
+        break;
+    case SIM_CONN_CLOSING:
+        yar_endpoint_outcome(cli, ep, RLOG_STATUS_EOF, 0, NULL, 0);
+        if (cli->on_eof != NULL) {
+            yar_endpoint_call(cli->on_eof, CBTYPE_EOF, ep);
+        }
+
+        if (ep->handle != NULL) {
+            yar_endpoint_handle_free(&ep->handle);
+        }
+
+        free(ep);
+        break;
+    }
+}
+
+/* a request was written to a simulated connection */
+static void yar_sim_request(struct yar_endpoint_handle *eph)
+{
+    struct yar_sim_conn *sc = eph->sim;
+
+    if (sc->state == SIM_CONN_WAITING && sc->target.resp_len > 0) {
+        sc->state = SIM_CONN_RESPONDING;
+        yar_sim_timer_add(_sim, &sc->net, 
+                (uint64_t)sc->target.rtt_us * 1000);
+    }
+}
+
+/**
+ * yar_sim_endpoint_new --
+ *     start a simulated connection attempt. Like datagram endpoints, 
+ *     simulated endpoints have no bufferevent, and their input is kept in
+ *     eph->input
+ */
+static struct yar_endpoint_handle *yar_sim_endpoint_new(
+        struct yar_connect_ticker *ticker, struct yar_endpoint *ep)
+{
+    struct yar_endpoint_handle *eph;
+    struct yar_sim_conn *sc;
+
+    eph = yar_endpoint_handle_new(ticker, ep, NULL);
+    if (eph == NULL) {
+        return NULL;
+    }
+
+    sc = malloc(sizeof(*sc));
+    if (sc == NULL) {
+        yar_endpoint_handle_free(&eph);
+        return NULL;
+    }
+
+    sc->state = SIM_CONN_CONNECTING;
+    yar_sim_timer_init(&sc->net, yar_sim_on_net, ep);
+    yar_sim_timer_init(&sc->timeout, yar_sim_on_timeout, ep);
+    yar_sim_timer_init(&sc->deadline, yar_sim_on_timeout, ep);
+    eph->sim = sc;
+    if (ticker->cli->on_read != NULL && 
+            (eph->input = evbuffer_new()) == NULL) {
+        yar_endpoint_handle_free(&eph);
+        return NULL;
+    }
+
+    /* dropped attempts are only ended by the connect timeout */
+    yar_sim_target(_sim, &ep->addr, ep->port, &sc->target);
+    if ((sc->target.outcome != SIM_DROP && yar_sim_timer_add(_sim, &sc->net,
+            (uint64_t)sc->target.rtt_us * 1000) < 0) ||
+            (ticker->to.connect != NULL && yar_sim_timer_add_common(_sim, 
+            &sc->timeout, yar_sim_connect_timeout(ticker, eph)) < 0) ||
+            (ticker->to.total != NULL && yar_sim_timer_add_common(_sim, 
+            &sc->deadline, yar_tv_ns(&ticker->to.fallback[3])) < 0)) {
+        yar_endpoint_handle_free(&eph);
+        return NULL;
+    }
+
+    if (_membudget > 0) {
+        yar_endpoint_track_memory(eph);
+    }
+
+    return eph;
+}
+
+/* reuse an idle connection to the address and port in ss, if any */
+static struct yar_endpoint_handle *yar_pool_take(
+        struct yar_connect_ticker *ticker, struct yar_endpoint *ep,
+        const struct sockaddr_storage *ss)
+{
+    struct yar_endpoint_handle *eph;
+
+    eph = yar_ephash_lookup(&_pool, (const struct sockaddr *)ss, 
+            yar_ephash_sum((const struct sockaddr *)ss));
+    if (eph == NULL) {
+        return NULL;
+    }
+
+    yar_ephash_remove(&_pool, eph);
+    free(eph->ep);
+    eph->ep = ep;
+    eph->mstate = 0;
+    eph->mscanned = 0;
+    eph->nmatches = 0;
+    eph->incounted = 0;
+    eph->flags &= ~(EPH_FLG_GOT_INPUT | EPH_FLG_RTT_CTO);
+    evutil_gettimeofday(&eph->tstart, NULL);
+    memset(&eph->times, 0, sizeof(eph->times));
+    eph->times.dispatch = yar_now_us();
+    yar_job_attach(ticker, eph);
+    bufferevent_setcb(eph->bev, 
+            ticker->cli->on_read != NULL ? yar_client_on_read : NULL, 
+            yar_client_write_cb(ticker->cli), yar_client_on_event, ep);
+    yar_endpoint_set_io_timeouts(eph);
+    bufferevent_setwatermark(eph->bev, EV_READ, 0, ticker->cli->rbufmax);
+    if (ticker->cli->on_read == NULL) {
+        bufferevent_disable(eph->bev, EV_READ);
+    }
+
+    return eph;
+}
+
+static struct yar_endpoint_handle *yar_tcp_endpoint_new(
+        struct yar_connect_ticker *ticker, struct yar_endpoint *ep)
+{
+    struct yar_endpoint_handle *eph;
+    struct bufferevent *bev;
+    const struct timeval *cto;
+    evutil_socket_t fd;
+
+    fd = socket(ep->addr.af, SOCK_STREAM, IPPROTO_TCP);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    evutil_make_socket_nonblocking(fd);
+    bev = bufferevent_socket_new(_evbase, fd, BEV_OPT_CLOSE_ON_FREE);
+    if (bev == NULL) {
+        evutil_closesocket(fd);
+        return NULL;
+    }
+
+    eph = yar_endpoint_handle_new(ticker, ep, bev);
+    if (eph == NULL) {
+        bufferevent_free(bev);
+        return NULL;
+    }
+
+    bufferevent_setcb(bev, 
+            ticker->cli->on_read != NULL ? yar_client_on_read : NULL, 
+            yar_client_write_cb(ticker->cli), yar_client_on_event, ep);
+
+    /* the connect phase is covered by the write event, but the
+       read event is pending as well, so both get the connect timeout.
+       They are replaced by the idle timeouts once connected */
+    if (ticker->to.connect != NULL) {
+        cto = yar_connect_timeout(ticker, eph);
+        bufferevent_set_timeouts(bev, cto, cto);
+    }
+
+    /* libevent stops reading at the high watermark and resumes once the
+       input has been drained below it */
+    if (ticker->cli->rbufmax > 0) {
+        bufferevent_setwatermark(bev, EV_READ, 0, ticker->cli->rbufmax);
+    }
+
+    if (ticker->cli->on_read == NULL) {
+        bufferevent_enable(bev, EV_WRITE);
+    } else {
+        bufferevent_enable(bev, EV_WRITE|EV_READ);
+    }
+
+    if (_membudget > 0) {
+        yar_endpoint_track_memory(eph);
+    }
+
+    return eph;
+}
+
+/**
+ * yar_connect_ticker_dispatch_connections --
+ *     start at most nconns connection attempts
+ *
+ * @return the number of attempts, including failed ones
+ */
+static unsigned int yar_connect_ticker_dispatch_connections(
+        struct yar_connect_ticker *ticker, unsigned int nconns)
+{
+    struct yar_endpoint *ep = NULL;
+    struct yar_client *cli;
+    yar_port_t port;
+    struct sockaddr_storage ss;
+    socklen_t sslen = 0;
+    unsigned int left = nconns;
+    bool ready;
+    int err;
+
+    assert(ticker != NULL);
+    cli = ticker->cli;
+    assert(cli != NULL);
+    assert(nconns > 0);
+
+    while (left > 0) {
+        if (!yar_portspec_next(ticker->portspec, &port)) {
+            if (!yar_addrspec_next(ticker->addrspec, &ticker->curr_addr)) {
+                ticker->flags |= CONNECT_TICKER_FLG_FINISHED_DISPATCHING;
+                break;
+            } else {
+                yar_portspec_reset(ticker->portspec);
+                continue;
+            }
+        }
+
+        ep = malloc(sizeof(*ep));
+        if (!ep) {
+            break;
+        }
+
+        METRICS_ADD(cli, dispatched, 1);
+        ticker->sum.dispatched++;
+        yar_addr_copy(&ep->addr, &ticker->curr_addr);
+        ep->port = port;
+        yar_addr_copy_to_storage(&ticker->curr_addr, 
+                (unsigned short)port, &ss, &sslen);
+        left--;
+
+        /* datagram endpoints and reused connections are usable right 
+           away, others once the connection is established */
+        ready = true;
+        if (ticker->udp != NULL) {
+            ep->handle = yar_udp_endpoint_new(ticker, ep, &ss);
+        } else if (_sim != NULL) {
+            ep->handle = yar_sim_endpoint_new(ticker, ep);
+            ready = false;
+        } else if (_pool.nentries == 0 || 
+                (ep->handle = yar_pool_take(ticker, ep, &ss)) == NULL) {
+            ep->handle = yar_tcp_endpoint_new(ticker, ep);
+            ready = false;
+        }
+
+        if (ep->handle == NULL) {
+            err = errno;
+            yar_endpoint_outcome(cli, ep, RLOG_STATUS_ERROR, err, NULL, 0);
+            yar_job_count(&ticker->sum, RLOG_STATUS_ERROR, err);
+            if (cli->on_error != NULL) {
+                errno = err;
+                yar_endpoint_call(cli->on_error, CBTYPE_ERROR, ep);
+            }
+
+            free(ep);
+            continue;
+        }
+
+        if (ticker->to.total != NULL && ep->handle->sim == NULL) {
+            ep->handle->deadline = evtimer_new(_evbase, 
+                    yar_endpoint_on_timeout, ep);
+            if (ep->handle->deadline != NULL) {
+                evtimer_add(ep->handle->deadline, ticker->to.total);
+            }
+        }
+
+        if (ready) {
+            if (ticker->udp == NULL) {
+                /* datagram endpoints are counted once they get a response */
+                yar_endpoint_outcome(cli, ep, RLOG_STATUS_ESTABLISHED, 0, 
+                        NULL, 0);
+            }
+
+            if (cli->on_established != NULL) {
+                yar_endpoint_call(cli->on_established, CBTYPE_ESTABLISHED, ep);
+                if (ep->handle == NULL) {
+                    free(ep);
+                }
+            }
+        } else if (ep->handle->sim == NULL && 
+                bufferevent_socket_connect(ep->handle->bev, 
+                (struct sockaddr *)&ss, sslen) < 0) { 
+            /* unable to initiate connection attempt
+               error should be handled by yar_client_on_event */
+            continue;
+        }
+    }
+
+    return nconns - left;
+}
+
+/**
+ * yar_job_stop_ticker --
+ *     stop dispatching, and note the first target that was not dispatched.
+ *     Endpoints still open when the grace period is over are closed by the
+ *     connect ticker
+ */
+static void yar_job_stop_ticker(struct yar_connect_ticker *ticker,
+        unsigned int status)
+{
+    struct yar_job_summary *sum = &ticker->sum;
+
+    if (ticker->flags & CONNECT_TICKER_FLG_STOPPED) {
+        return;
+    }
+
+    ticker->flags |= CONNECT_TICKER_FLG_STOPPED;
+    ticker->stop_at = yar_now_us() + ticker->cli->grace;
+    sum->status = status;
+    if (ticker->flags & CONNECT_TICKER_FLG_FINISHED_DISPATCHING) {
+        return;
+    }
+
+    ticker->flags |= CONNECT_TICKER_FLG_FINISHED_DISPATCHING;
+    for (;;) {
+        if (yar_portspec_next(ticker->portspec, &sum->resume_port)) {
+            sum->resumable = 1;
+            yar_addr_copy(&sum->resume_addr, &ticker->curr_addr);
+            break;
+        } else if (!yar_addrspec_next(ticker->addrspec, &ticker->curr_addr)) {
+            break;
+        }
+
+        yar_portspec_reset(ticker->portspec);
+    }
+}
+
+/* close the open endpoints of a stopped job with ECANCELED */
+static void yar_job_cancel(struct yar_connect_ticker *ticker)
+{
+    struct yar_endpoint_handle *eph;
+
+    while ((eph = ticker->live) != NULL) {
+        ticker->sum.cancelled++;
+        yar_endpoint_fail(eph->ep, ECANCELED);
+    }
+}
+
+/* the job is done, report its summary */
+static void yar_job_done(struct yar_connect_ticker *ticker)
+{
+    ticker->sum.elapsed_us = yar_now_us() - ticker->start;
+    if (ticker->cli->summary != NULL) {
+        memcpy(ticker->cli->summary, &ticker->sum, sizeof(ticker->sum));
+    }
+}
+
+static int yar_connect_ticker_cb(void *data, unsigned long missed)
+{
+    struct yar_connect_ticker *ticker = data;
+    struct yar_client *cli;
+    unsigned int nconn_max = 0, cpt; 
+    
+    assert(ticker != NULL);
+    assert(ticker->addrspec != NULL);
+    assert(ticker->portspec != NULL);
+    cli = ticker->cli;
+    assert(cli != NULL);
+
+    ticker->allowed = 0;
+    if (cli->jto > 0 && !(ticker->flags & CONNECT_TICKER_FLG_STOPPED) &&
+            yar_now_us() - ticker->start >= (uint64_t)cli->jto * 1000000) {
+        yar_job_stop_ticker(ticker, JOB_DEADLINE);
+    }
+
+    if ((ticker->flags & CONNECT_TICKER_FLG_STOPPED) && 
+            ticker->ncurrent > 0 && yar_now_us() >= ticker->stop_at) {
+        yar_job_cancel(ticker);
+    }
+
+    if (ticker->flags & CONNECT_TICKER_FLG_FINISHED_DISPATCHING) {
+        if (ticker->ncurrent == 0) {
+            yar_job_done(ticker);
+            return TICKER_DONE;
+        }
+
+        return TICKER_CONT;
+    }
+
+    if (_membudget > 0 && _membuffered >= _membudget) {
+        /* wait for buffered data to be consumed or sent */
+        return TICKER_CONT;
+    }
+
+    if (cli->sink != NULL && yar_sink_congested(cli->sink)) {
+        /* wait for the results to be written */
+        return TICKER_CONT;
+    }
+
+    /* catch up on missed ticks, but at most one second's worth */
+    if (missed >= cli->tr) {
+        missed = cli->tr > 0 ? cli->tr - 1 : 0;
+    }
+
+    if (cli->cpt > UINT_MAX / (missed + 1)) {
+        cpt = UINT_MAX;
+    } else {
+        cpt = cli->cpt * (unsigned int)(missed + 1);
+    }
+
+    /* determine maximum number of allowed connections for this tick */
+    if (cli->tr == 0 || (cli->cpt == 0 && cli->ncc == 0)) {
+        nconn_max = UINT_MAX;
+    } else {
+        if (cpt > 0) {
+            if (cli->ncc > 0) {
+                assert(cli->ncc >= ticker->ncurrent);
+                nconn_max = cli->ncc - ticker->ncurrent;
+                if (nconn_max > cpt) {
+                    nconn_max = cpt;
+                }
+            } else {
+                nconn_max = cpt;
+            }
+        } else {
+            assert(cli->ncc > 0);
+            assert(cli->ncc >= ticker->ncurrent);
+            nconn_max = cli->ncc - ticker->ncurrent;
+        }
+    }
+
+    if (ticker->flags & CONNECT_TICKER_FLG_SCHEDULED) {
+        ticker->allowed = nconn_max;
+    } else if (nconn_max > 0) {
+        yar_connect_ticker_dispatch_connections(ticker, nconn_max);
+    }
+
+    return TICKER_CONT;
+}
+
+/* the number of connections a scheduled job can start right now */
+static unsigned int yar_sched_demand(const struct yar_connect_ticker *ticker)
+{
+    const struct yar_client *cli = ticker->cli;
+    unsigned int n;
+
+    if (ticker->flags & CONNECT_TICKER_FLG_FINISHED_DISPATCHING) {
+        return 0;
+    }
+
+    n = ticker->allowed;
+    if (cli->ncc > 0 && cli->tr > 0 && n > cli->ncc - ticker->ncurrent) {
+        n = cli->ncc - ticker->ncurrent;
+    }
+
+    return n;
+}
+
+static int yar_sched_cb(void *data, unsigned long missed)
+{
+    struct yar_connect_ticker *t, *first;
+    uint64_t budget, weights, quantum, n;
+    unsigned int ncurrent = 0, want;
+    bool progress;
+
+    if (_sched.jobs == NULL) {
+        _sched.running = false;
+        _sched.next = NULL;
+        return TICKER_DONE;
+    }
+
+    if (missed >= SCHED_TICKRATE) {
+        missed = SCHED_TICKRATE - 1;
+    }
+
+    budget = UINT64_MAX;
+    if (_sched.cps > 0) {
+        _sched.frac += (uint64_t)_sched.cps * (missed + 1);
+        budget = _sched.frac / SCHED_TICKRATE;
+        _sched.frac %= SCHED_TICKRATE;
+    }
+
+    if (_sched.ncc > 0) {
+        for (t = _sched.jobs; t != NULL; t = t->snext) {
+            ncurrent += t->ncurrent;
+        }
+
+        n = ncurrent < _sched.ncc ? _sched.ncc - ncurrent : 0;
+        if (n < budget) {
+            budget = n;
+        }
+    }
+
+    /* rounds of deficit round-robin, each job gets a quantum in proportion
+       to its weight and dispatches as much of its deficit as it can. A job
+       without demand loses its deficit */
+    do {
+        weights = 0;
+        for (t = _sched.jobs; t != NULL; t = t->snext) {
+            if (yar_sched_demand(t) > 0) {
+                weights += t->cli->weight > 0 ? t->cli->weight : 1;
+            } else {
+                t->deficit = 0;
+            }
+        }
+
+        if (weights == 0 || budget == 0) {
+            break;
+        }
+
+        quantum = budget / weights;
+        if (quantum == 0) {
+            quantum = 1;
+        }
+
+        progress = false;
+        first = _sched.next != NULL ? _sched.next : _sched.jobs;
+        t = first;
+        do {
+            want = yar_sched_demand(t);
+            if (want > 0) {
+                t->deficit += quantum * 
+                        (t->cli->weight > 0 ? t->cli->weight : 1);
+                n = t->deficit < want ? t->deficit : want;
+                if (n > budget) {
+                    n = budget;
+                }
+
+                n = yar_connect_ticker_dispatch_connections(t, 
+                        (unsigned int)n);
+                t->allowed -= (unsigned int)n;
+                budget -= n;
+                t->deficit = n < want ? t->deficit - n : 0;
+                if (n > 0) {
+                    progress = true;
+                }
+            }
+
+            t = t->snext != NULL ? t->snext : _sched.jobs;
+        } while (t != first && budget > 0);
+
+        _sched.next = t;
+    } while (progress && budget > 0);
+
+    return TICKER_CONT;
+}
+
+const char *yar_endpoint_get_errmsg(yar_endpoint_handle_t *eph)
+{
+    const char *cptr;
+
+    if (eph == NULL) {
+        /* if eph is null, we couldn't establish the connection */
+        return "connection failed";
+    } else {
+        /* Getting some valgrind errors on line below */
+        cptr = evutil_socket_error_to_string(EVUTIL_SOCKET_ERROR());
+        return cptr != NULL ? cptr : "unknown error";
+    }
+}
+
+void yar_endpoint_set_cdata(struct yar_endpoint_handle *eph, void *cdata,
+        yar_cleanup_func free_cb)
+{
+    assert(eph != NULL);
+    eph->cdata = cdata;
+    eph->free_cb = free_cb;
+}
+
+void *yar_endpoint_get_cdata(struct yar_endpoint_handle *eph)
+{
+    assert(eph != NULL);
+    return eph->cdata; 
+}
+
+void *yar_endpoint_read(yar_endpoint_handle_t *eph, size_t *len)
+{
+    size_t readlen;
+    struct evbuffer *evb;
+    void *ret;
+    assert(eph != NULL);
+    assert(len != NULL);
+
+    evb = yar_endpoint_input(eph);
+    if (evb == NULL) {
+        *len = 0;
+        return NULL;
+    }
+
+    readlen = evbuffer_get_length(evb);
+    if (readlen > 0) {
+        ret = evbuffer_pullup(evb, readlen);
+        *len = readlen;
+        return ret;
+    } else {
+        *len = 0;
+        return NULL;
+    }
+}
+
+/* struct evbuffer_iovec is documented to have the layout of struct iovec */
+typedef char yar_iovec_layout_check[
+        sizeof(struct evbuffer_iovec) == sizeof(struct iovec) ? 1 : -1];
+
+int yar_endpoint_peek(yar_endpoint_handle_t *eph, struct iovec *iov, 
+        int niov)
+{
+    struct evbuffer *evb;
+
+    assert(eph != NULL);
+    assert(iov != NULL || niov == 0);
+
+    evb = yar_endpoint_input(eph);
+    if (evb == NULL) {
+        return 0;
+    }
+
+    return evbuffer_peek(evb, -1, NULL, (struct evbuffer_iovec *)iov, niov);
+}
+
+size_t yar_endpoint_matches(yar_endpoint_handle_t *eph, 
+        const unsigned int **ids)
+{
+    assert(eph != NULL);
+    assert(ids != NULL);
+
+    *ids = eph->matches;
+    return eph->nmatches;
+}
+
+const struct yar_endpoint_times *yar_endpoint_get_times(
+        yar_endpoint_handle_t *eph)
+{
+    return eph != NULL ? &eph->times : NULL;
+}
+
+size_t yar_endpoint_msglen(yar_endpoint_handle_t *eph)
+{
+    struct evbuffer *evb;
+    size_t len;
+
+    assert(eph != NULL);
+
+    evb = yar_endpoint_input(eph);
+    len = evb != NULL ? evbuffer_get_length(evb) : 0;
+    /* a validator may know the length before the whole message is read,
+       e.g., when truncated input is passed to on_read */
+    if (eph->rvs.msglen > 0 && eph->rvs.msglen < len) {
+        return eph->rvs.msglen;
+    }
+
+    return len;
+}
+
+void yar_endpoint_consume(yar_endpoint_handle_t *eph, size_t n)
+{
+    struct evbuffer *evb;
+    size_t len;
+
+    assert(eph != NULL);
+
+    evb = yar_endpoint_input(eph);
+    if (evb == NULL) {
+        return;
+    }
+
+    len = evbuffer_get_length(evb);
+    if (n > len) {
+        n = len;
+    }
+
+    evbuffer_drain(evb, n);
+    yar_endpoint_drained(eph, n);
+    eph->consumed += n;
+}
+
+/* check that len more bytes may be added to the output of a connection */
+static int yar_endpoint_can_write(struct yar_endpoint_handle *eph, 
+        size_t len)
+{
+    size_t wbufmax;
+
+    assert(eph->bev != NULL);
+
+    if (eph->flags & EPH_FLG_SHUTDOWN_WR) {
+        errno = EPIPE;
+        return -1;
+    }
+
+    wbufmax = eph->ticker->cli->wbufmax;
+    if (wbufmax > 0 && len + evbuffer_get_length(
+            bufferevent_get_output(eph->bev)) > wbufmax) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int yar_endpoint_write(yar_endpoint_handle_t *eph, const void *data, 
+        size_t len)
+{   
+    struct sockaddr_storage ss;
+    socklen_t sslen;
+
+    assert(eph != NULL);
+    assert(data != NULL);
+
+    if (eph->usock != NULL) {
+        yar_addr_copy_to_storage(&eph->ep->addr, (unsigned short)eph->ep->port,
+                &ss, &sslen);
+        if (yar_udp_sock_queue(eph->usock, &ss, sslen, data, len) < 0) {
+            return -1;
+        }
+    } else if (eph->sim != NULL) {
+        yar_sim_request(eph);
+    } else if (yar_endpoint_can_write(eph, len) < 0 || 
+            bufferevent_write(eph->bev, data, len) < 0) {
+        return -1;
+    }
+
+    METRICS_ADD(eph->ticker->cli, bytes_out, len);
+    return 0;
+}
+
+int yar_endpoint_writev(yar_endpoint_handle_t *eph, const struct iovec *iov,
+        int niov)
+{
+    struct evbuffer_iovec vec;
+    unsigned char buf[WRITEV_STACKBUF], *dst;
+    size_t len = 0;
+    int i, ret;
+
+    assert(eph != NULL);
+    assert(iov != NULL || niov == 0);
+
+    for (i = 0; i < niov; i++) {
+        len += iov[i].iov_len;
+    }
+
+    if (len == 0) {
+        return 0;
+    }
+
+    /* datagrams are sent as one message, gather it first */
+    if (eph->bev == NULL) {
+        dst = len <= sizeof(buf) ? buf : malloc(len);
+        if (dst == NULL) {
+            return -1;
+        }
+
+        for (i = 0, len = 0; i < niov; i++) {
+            memcpy(dst + len, iov[i].iov_base, iov[i].iov_len);
+            len += iov[i].iov_len;
+        }
+
+        ret = yar_endpoint_write(eph, dst, len);
+        if (dst != buf) {
+            free(dst);
+        }
+
+        return ret;
+    }
+
+    if (yar_endpoint_can_write(eph, len) < 0 || 
+            evbuffer_reserve_space(bufferevent_get_output(eph->bev), 
+            (ev_ssize_t)len, &vec, 1) != 1) {
+        return -1;
+    }
+
+    dst = vec.iov_base;
+    for (i = 0; i < niov; i++) {
+        memcpy(dst, iov[i].iov_base, iov[i].iov_len);
+        dst += iov[i].iov_len;
+    }
+
+    vec.iov_len = len;
+    if (evbuffer_commit_space(bufferevent_get_output(eph->bev), &vec, 1) 
+            < 0) {
+        return -1;
+    }
+
+    METRICS_ADD(eph->ticker->cli, bytes_out, len);
+    return 0;
+}
+
+yar_payload_t *yar_payload_new(const void *data, size_t len)
+{
+    yar_payload_t *p;
+
+    assert(data != NULL || len == 0);
+
+    p = malloc(sizeof(*p) + len);
+    if (p == NULL) {
+        return NULL;
+    }
+
+    p->refs = 1;
+    p->len = len;
+    if (len > 0) {
+        memcpy(p->data, data, len);
+    }
+
+    return p;
+}
+
+yar_payload_t *yar_payload_ref(yar_payload_t *p)
+{
+    assert(p != NULL);
+    assert(p->refs > 0);
+
+    p->refs++;
+    return p;
+}
+
+void yar_payload_unref(yar_payload_t *p)
+{
+    if (p != NULL) {
+        assert(p->refs > 0);
+        if (--p->refs == 0) {
+            free(p);
+        }
+    }
+}
+
+/* called by libevent when a reference has been written, or its buffer 
+   freed */
+static void yar_payload_cleanup(const void *data, size_t len, void *arg)
+{
+    yar_payload_unref(arg);
+}
+
+int yar_endpoint_write_payload(yar_endpoint_handle_t *eph, yar_payload_t *p)
+{
+    assert(eph != NULL);
+    assert(p != NULL);
+
+    /* datagrams are copied into the send batch of their socket anyway */
+    if (eph->bev == NULL) {
+        return yar_endpoint_write(eph, p->data, p->len);
+    } else if (p->len == 0) {
+        return 0;
+    }
+
+    if (yar_endpoint_can_write(eph, p->len) < 0) {
+        return -1;
+    }
+
+    yar_payload_ref(p);
+    if (evbuffer_add_reference(bufferevent_get_output(eph->bev), p->data,
+            p->len, yar_payload_cleanup, p) < 0) {
+        yar_payload_unref(p);
+        return -1;
     }
+
+    METRICS_ADD(eph->ticker->cli, bytes_out, p->len);
+    return 0;
 }
 
-static int yar_connect_ticker_cb(void *data)
+int yar_endpoint_write_tmpl(yar_endpoint_handle_t *eph, const yar_tmpl_t *t)
 {
-    struct yar_connect_ticker *ticker = data;
-    struct yar_client *cli;
-    unsigned int nconn_max = 0; 
-    
-    assert(ticker != NULL);
-    assert(ticker->addrspec != NULL);
-    assert(ticker->portspec != NULL);
-    cli = ticker->cli;
-    assert(cli != NULL);
+    struct evbuffer_iovec vec;
+    struct evbuffer *out;
+    unsigned char buf[TMPL_STACKBUF], *tmp;
+    size_t len, maxlen;
+    int ret;
 
-    if (ticker->flags & CONNECT_TICKER_FLG_FINISHED_DISPATCHING) {
-        if (ticker->ncurrent == 0) {
-            return TICKER_DONE;
+    assert(eph != NULL);
+    assert(t != NULL);
+
+    maxlen = yar_tmpl_maxlen(t);
+    if (eph->bev == NULL) {
+        tmp = maxlen <= sizeof(buf) ? buf : malloc(maxlen);
+        if (tmp == NULL) {
+            return -1;
         }
 
-        return TICKER_CONT;
+        len = yar_tmpl_render(t, &eph->ep->addr, eph->ep->port, tmp);
+        ret = yar_endpoint_write(eph, tmp, len);
+        if (tmp != buf) {
+            free(tmp);
+        }
+
+        return ret;
+    } else if (maxlen == 0) {
+        return 0;
     }
 
-    /* determine maximum number of allowed connections for this tick */
-    if (cli->tr == 0 || (cli->cpt == 0 && cli->ncc == 0)) {
-        nconn_max = UINT_MAX;
-    } else {
-        if (cli->cpt > 0) {
-            if (cli->ncc > 0) {
-                assert(cli->ncc >= ticker->ncurrent);
-                nconn_max = cli->ncc - ticker->ncurrent;
-                if (nconn_max > cli->cpt) {
-                    nconn_max = cli->cpt;
-                }
-            } else {
-                nconn_max = cli->cpt;
-            }
-        } else {
-            assert(cli->ncc > 0);
-            assert(cli->ncc >= ticker->ncurrent);
-            nconn_max = cli->ncc - ticker->ncurrent;
-        }
+    /* render straight into the output buffer, once it is known that the 
+       longest rendering may be added to it */
+    assert(eph->bev != NULL);
+    if (yar_endpoint_can_write(eph, maxlen) < 0) {
+        return -1;
     }
 
-    if (ticker->ncurrent < nconn_max) {
-        yar_connect_ticker_dispatch_connections(ticker, nconn_max);
+    out = bufferevent_get_output(eph->bev);
+    if (evbuffer_reserve_space(out, (ev_ssize_t)maxlen, &vec, 1) != 1) {
+        return -1;
     }
 
-    return TICKER_CONT;
+    len = yar_tmpl_render(t, &eph->ep->addr, eph->ep->port, vec.iov_base);
+    vec.iov_len = len;
+    if (evbuffer_commit_space(out, &vec, 1) < 0) {
+        return -1;
+    }
+
+    METRICS_ADD(eph->ticker->cli, bytes_out, len);
+    return 0;
 }
 
-const char *yar_endpoint_get_errmsg(yar_endpoint_handle_t *eph)
+void yar_endpoint_terminate(struct yar_endpoint *ep)
 {
-    const char *cptr;
+    yar_endpoint_handle_free(&ep->handle);
+}
 
-    if (eph == NULL) {
-        /* if eph is null, we couldn't establish the connection */
-        return "connection failed";
-    } else {
-        /* Getting some valgrind errors on line below */
-        cptr = evutil_socket_error_to_string(EVUTIL_SOCKET_ERROR());
-        return cptr != NULL ? cptr : "unknown error";
+static void yar_endpoint_queue_request(struct yar_endpoint_handle *eph,
+        struct yar_request *req)
+{
+    req->next = NULL;
+    *eph->reqtail = req;
+    eph->reqtail = &req->next;
+    eph->nqueued++;
+
+    if (eph->nsent == 0 || (eph->ticker->cli->flags & CLIENT_FLG_PIPELINE)) {
+        yar_endpoint_send_request(eph);
     }
 }
 
-void yar_endpoint_set_cdata(struct yar_endpoint_handle *eph, void *cdata,
-        yar_cleanup_func free_cb)
+int yar_endpoint_enqueue(yar_endpoint_handle_t *eph, const void *data,
+        size_t len)
 {
+    struct yar_request *req;
+
     assert(eph != NULL);
-    eph->cdata = cdata;
-    eph->free_cb = free_cb;
+    assert(data != NULL);
+
+    req = malloc(sizeof(*req) + len);
+    if (req == NULL) {
+        return -1;
+    }
+
+    req->payload = NULL;
+    req->len = len;
+    memcpy(req->data, data, len);
+    yar_endpoint_queue_request(eph, req);
+    return 0;
 }
 
-void *yar_endpoint_get_cdata(struct yar_endpoint_handle *eph)
+int yar_endpoint_enqueue_payload(yar_endpoint_handle_t *eph, 
+        yar_payload_t *p)
 {
+    struct yar_request *req;
+
     assert(eph != NULL);
-    return eph->cdata; 
+    assert(p != NULL);
+
+    req = malloc(sizeof(*req));
+    if (req == NULL) {
+        return -1;
+    }
+
+    req->payload = yar_payload_ref(p);
+    req->len = 0;
+    yar_endpoint_queue_request(eph, req);
+    return 0;
 }
 
-void *yar_endpoint_read(yar_endpoint_handle_t *eph, size_t *len)
+unsigned int yar_endpoint_pending(yar_endpoint_handle_t *eph)
 {
-    size_t readlen;
-    struct evbuffer *evb;
-    void *ret;
     assert(eph != NULL);
-    assert(len != NULL);
-    assert(eph->bev != NULL);
+    return eph->nqueued + eph->nsent;
+}
 
-    evb = bufferevent_get_input(eph->bev);
-    readlen = evbuffer_get_length(evb);
-    if (readlen > 0) {
-        ret = evbuffer_pullup(evb, readlen);
-        *len = readlen;
-        return ret;
-    } else {
-        *len = 0;
-        return NULL;
+void yar_endpoint_release(struct yar_endpoint *ep)
+{
+    struct yar_endpoint_handle *eph;
+    struct yar_endpoint *idle;
+    struct yar_client *cli;
+    const struct timeval *idle_to;
+    struct sockaddr_storage ss;
+
+    assert(ep != NULL);
+    assert(ep->handle != NULL);
+
+    eph = ep->handle;
+    cli = eph->ticker->cli;
+    if (cli->npool == 0 || _pool.nentries >= cli->npool ||
+            eph->bev == NULL || !(eph->flags & EPH_FLG_ESTABLISHED) ||
+            (eph->flags & EPH_FLG_SHUTDOWN_WR) ||
+            yar_endpoint_pending(eph) > 0 ||
+            evbuffer_get_length(bufferevent_get_input(eph->bev)) > 0 ||
+            evbuffer_get_length(bufferevent_get_output(eph->bev)) > 0) {
+        yar_endpoint_terminate(ep);
+        return;
+    }
+
+    /* the caller's endpoint is freed when we return, the pool gets a
+       copy of its own */
+    idle = malloc(sizeof(*idle));
+    if (idle == NULL) {
+        yar_endpoint_terminate(ep);
+        return;
+    }
+
+    memcpy(idle, ep, sizeof(*idle));
+    idle->handle = eph;
+    eph->ep = idle;
+    ep->handle = NULL;
+
+    if (eph->free_cb != NULL && eph->cdata != NULL) {
+        eph->free_cb(eph->cdata);
+    }
+
+    eph->cdata = NULL;
+    eph->free_cb = NULL;
+    if (eph->deadline != NULL) {
+        event_free(eph->deadline);
+        eph->deadline = NULL;
+    }
+
+    /* an on_read handler that releases the connection returns before the
+       validator state of its message is cleared */
+    memset(&eph->rvs, 0, sizeof(eph->rvs));
+    idle_to = eph->ticker->to.read;
+    yar_job_detach(eph);
+    eph->ticker = NULL;
+
+    yar_addr_copy_to_storage(&idle->addr, (unsigned short)idle->port, &ss,
+            NULL);
+    eph->hkey = yar_ephash_sum((struct sockaddr *)&ss);
+    bufferevent_setcb(eph->bev, yar_pool_on_read, NULL, yar_pool_on_event, 
+            eph);
+    bufferevent_set_timeouts(eph->bev, idle_to, NULL);
+    bufferevent_enable(eph->bev, EV_READ);
+    if (yar_ephash_insert(&_pool, eph) < 0) {
+        free(idle);
+        eph->ep = NULL;
+        yar_endpoint_handle_free(&eph);
     }
 }
 
-void yar_endpoint_write(yar_endpoint_handle_t *eph, const void *data, 
-        size_t len)
-{   
-    assert(eph != NULL);
-    assert(eph->bev != NULL);
-    assert(data != NULL);
+static void yar_ticker_free(struct yar_ticker *t)
+{
+    if (t->ev != NULL) {
+        event_free(t->ev);
+    }
+
+    if (t->fd >= 0) {
+        close(t->fd);
+    }
 
-    bufferevent_write(eph->bev, data, len);
+    free(t);
 }
 
-void yar_endpoint_terminate(struct yar_endpoint *ep)
+/* arm the timeout for the next deadline, for tickers without a timerfd */
+static void yar_ticker_arm(struct yar_ticker *t, uint64_t now)
 {
-    yar_endpoint_handle_free(&ep->handle);
+    struct timeval tv;
+    uint64_t left;
+
+    left = t->next > now ? t->next - now : 0;
+    tv.tv_sec = (time_t)(left / NSEC_PER_SEC);
+    tv.tv_usec = (suseconds_t)((left % NSEC_PER_SEC) / 1000);
+    event_add(t->ev, &tv);
 }
 
-static void yar_ticker_cb(evutil_socket_t cfd, short what, void *data)
+static void yar_ticker_cb(evutil_socket_t fd, short what, void *data)
 {
     struct yar_ticker *t;
+    uint64_t nticks, now = 0, start = 0;
+    ssize_t ret;
+    int status;
+
     assert(data != NULL);
     
     t = data;
-    if (t->f(t->data) == TICKER_DONE) {
+    if (t->fd >= 0) {
+        ret = read(t->fd, &nticks, sizeof(nticks));
+        if (ret != sizeof(nticks) || nticks == 0) {
+            return;
+        }
+
+        t->next += nticks * t->period;
+    } else {
+        now = yar_monotonic_ns();
+        nticks = now >= t->next ? (now - t->next) / t->period + 1 : 0;
+        t->next += nticks * t->period;
+        yar_ticker_arm(t, now);
+        if (nticks == 0) {
+            return;
+        }
+    }
+
+    if (_prof.rate > 0) {
+        /* lag behind the last deadline that passed */
+        if (now == 0) {
+            now = yar_monotonic_ns();
+        }
+
+        yar_hist_record(&_prof.p.lag_us, 
+                now > t->next - t->period ? 
+                (now - (t->next - t->period)) / 1000 : 0);
+        start = yar_profile_start(CBTYPE_TICKER);
+    }
+
+    status = t->f(t->data, (unsigned long)(nticks - 1));
+    if (start != 0) {
+        yar_profile_end(CBTYPE_TICKER, start, NULL, 0);
+    }
+
+    if (status == TICKER_DONE) {
         if (t->free_cb != NULL) {
             t->free_cb(t->data);
         }
 
-        event_free(t->ev);
-        free(t);
+        yar_ticker_free(t);
+    }
+}
+
+/* tickers on the virtual clock, which never fall behind */
+static void yar_ticker_sim_cb(void *data)
+{
+    struct yar_ticker *t = data;
+    uint64_t start = 0;
+    int status;
+
+    t->next += t->period;
+    if (_prof.rate > 0) {
+        yar_hist_record(&_prof.p.lag_us, 0);
+        start = yar_profile_start(CBTYPE_TICKER);
+    }
+
+    status = t->f(t->data, 0);
+    if (start != 0) {
+        yar_profile_end(CBTYPE_TICKER, start, NULL, 0);
+    }
+
+    if (status == TICKER_DONE) {
+        if (t->free_cb != NULL) {
+            t->free_cb(t->data);
+        }
+
+        yar_ticker_free(t);
+    } else {
+        yar_sim_timer_add(_sim, &t->vt, t->period);
     }
 }
 
@@ -474,7 +3303,10 @@ int yar_ticker(yar_ticker_func func, unsigned int tick_rate, void *data,
         yar_cleanup_func free_cb)
 {
     struct yar_ticker *t;
-    struct timeval tv;
+#ifdef __linux__
+    struct itimerspec its;
+#endif
+
     assert(func != NULL);
     assert(tick_rate > 0);
 
@@ -485,23 +3317,63 @@ int yar_ticker(yar_ticker_func func, unsigned int tick_rate, void *data,
         return -1;
     }
 
-    if (tick_rate > 1000000) {
-        tick_rate = 1000000;
-    }
-
-    tv.tv_sec = 0; 
-    tv.tv_usec = 1000000 / tick_rate;
     t->f = func;
     t->data = data;
     t->free_cb = free_cb;
-    t->ev = event_new(_evbase, -1, EV_TIMEOUT|EV_PERSIST, 
-            yar_ticker_cb, t);
+    t->period = NSEC_PER_SEC / tick_rate;
+    if (t->period == 0) {
+        t->period = 1;
+    }
+
+    t->fd = -1;
+    t->ev = NULL;
+    if (_sim != NULL) {
+        t->next = yar_monotonic_ns() + t->period;
+        yar_sim_timer_init(&t->vt, yar_ticker_sim_cb, t);
+        if (yar_sim_timer_add(_sim, &t->vt, t->period) < 0) {
+            free(t);
+            return -1;
+        }
+
+        return 0;
+    }
+
+#ifdef __linux__
+    t->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+    if (t->fd >= 0) {
+        its.it_interval.tv_sec = (time_t)(t->period / NSEC_PER_SEC);
+        its.it_interval.tv_nsec = (long)(t->period % NSEC_PER_SEC);
+        its.it_value = its.it_interval;
+        if (timerfd_settime(t->fd, 0, &its, NULL) < 0) {
+            close(t->fd);
+            t->fd = -1;
+        }
+    }
+#endif
+
+    if (t->fd >= 0) {
+        t->ev = event_new(_evbase, t->fd, EV_READ|EV_PERSIST, 
+                yar_ticker_cb, t);
+    } else {
+        t->ev = event_new(_evbase, -1, EV_TIMEOUT, yar_ticker_cb, t);
+    }
+
     if (t->ev == NULL) {
+        if (t->fd >= 0) {
+            close(t->fd);
+        }
+
         free(t);
         return -1;
     }
     
-    event_add(t->ev, &tv);
+    t->next = yar_monotonic_ns() + t->period;
+    if (t->fd >= 0) {
+        event_add(t->ev, NULL);
+    } else {
+        yar_ticker_arm(t, t->next - t->period);
+    }
+
     return 0;
 }
 
@@ -517,7 +3389,8 @@ int yar_connect(struct yar_client *cli, const char *addrspec,
 
     YARINIT();
 
-    if (cli->proto != ADDRPROTO_TCP && cli->proto != ADDRPROTO_UDP) {
+    if ((cli->proto != ADDRPROTO_TCP && cli->proto != ADDRPROTO_UDP) ||
+            (_sim != NULL && cli->proto != ADDRPROTO_TCP)) {
         return -1;
     }
 
@@ -533,6 +3406,21 @@ int yar_connect(struct yar_client *cli, const char *addrspec,
         tick_rate = cli->tr;
     }
 
+    if (_sched.ncc > 0 || _sched.cps > 0) {
+        if (!_sched.running) {
+            if (yar_ticker(yar_sched_cb, SCHED_TICKRATE, NULL, NULL) < 0) {
+                yar_connect_ticker_free(ticker);
+                return -1;
+            }
+
+            _sched.running = true;
+        }
+
+        ticker->flags |= CONNECT_TICKER_FLG_SCHEDULED;
+        ticker->snext = _sched.jobs;
+        _sched.jobs = ticker;
+    }
+
     if (yar_ticker(yar_connect_ticker_cb, tick_rate, ticker, 
             yar_connect_ticker_free) < 0) {
         yar_connect_ticker_free(ticker);
@@ -542,14 +3430,156 @@ int yar_connect(struct yar_client *cli, const char *addrspec,
     return 0;
 }
 
+void yar_set_limits(unsigned int ncc, unsigned int cps)
+{
+    _sched.ncc = ncc;
+    _sched.cps = cps;
+}
+
+int yar_job_stop(struct yar_client *cli)
+{
+    struct yar_connect_ticker *ticker;
+    int found = 0;
+
+    assert(cli != NULL);
+
+    for (ticker = _jobs; ticker != NULL; ticker = ticker->jnext) {
+        if (ticker->cli == cli) {
+            yar_job_stop_ticker(ticker, JOB_STOPPED);
+            found = 1;
+        }
+    }
+
+    if (!found) {
+        errno = ESRCH;
+        return -1;
+    }
+
+    return 0;
+}
+
+void yar_set_profiling(unsigned int rate, unsigned int slow_us,
+        yar_sink_t *sink)
+{
+    _prof.rate = rate;
+    _prof.countdown = 1; /* the next call is timed */
+    _prof.slow_us = slow_us;
+    _prof.sink = sink;
+}
+
+void yar_get_profile(struct yar_profile *p)
+{
+    assert(p != NULL);
+    memcpy(p, &_prof.p, sizeof(*p));
+}
+
+void yar_get_metrics(struct yar_metrics *m)
+{
+    assert(m != NULL);
+    memcpy(m, &_metrics, sizeof(*m));
+}
+
+struct yar_metrics_export {
+    yar_sink_t *sink;
+    unsigned int interval;
+    unsigned int ticks;
+};
+
+static int yar_metrics_export_cb(void *data, unsigned long missed)
+{
+    struct yar_metrics_export *exp = data;
+
+    exp->ticks += (unsigned int)missed + 1;
+    if (exp->ticks < exp->interval && _njobs > 0) {
+        return TICKER_CONT;
+    }
+
+    exp->ticks = 0;
+    yar_metrics_print(exp->sink, "yar", &_metrics);
+    if (_prof.rate > 0) {
+        yar_profile_print(exp->sink, "yar", &_prof.p);
+    }
+
+    return _njobs > 0 ? TICKER_CONT : TICKER_DONE;
+}
+
+int yar_export_metrics(yar_sink_t *sink, unsigned int interval)
+{
+    struct yar_metrics_export *exp;
+
+    assert(sink != NULL);
+
+    exp = malloc(sizeof(*exp));
+    if (exp == NULL) {
+        return -1;
+    }
+
+    exp->sink = sink;
+    exp->interval = interval > 0 ? interval : 1;
+    exp->ticks = 0;
+    if (yar_ticker(yar_metrics_export_cb, 1, exp, free) < 0) {
+        free(exp);
+        return -1;
+    }
+
+    return 0;
+}
+
+void yar_set_membudget(size_t bytes)
+{
+    _membudget = bytes;
+}
+
+size_t yar_get_membuffered()
+{
+    return _membuffered;
+}
+
+/**
+ * yar_sim_main --
+ *     run the virtual clock until no timers are left. libevent is polled
+ *     now and then, for anything that is not simulated
+ */
+static int yar_sim_main()
+{
+    unsigned long n = 0;
+
+    while (yar_sim_run_once(_sim)) {
+        if (++n % SIM_POLL_INTERVAL == 0 && 
+                event_base_loop(_evbase, EVLOOP_NONBLOCK) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int yar_set_sim(yar_sim_t *sim)
+{
+    if (_njobs > 0) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    _sim = sim;
+    return 0;
+}
+
 int yar_main()
 {
     int retval;
 
     YARINIT();
-    retval = event_base_dispatch(_evbase);
+    if (_sim != NULL) {
+        retval = yar_sim_main();
+    } else {
+        retval = event_base_dispatch(_evbase);
+    }
+
+    yar_pool_clear();
     event_base_free(_evbase);
     _evbase = NULL;
+    _ncommon_timeouts = 0;
     return retval;
 }
 
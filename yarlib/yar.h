@@ -26,8 +26,18 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef __YAR_H
 #define __YAR_H
 
+#include <stdint.h>
+#include <sys/uio.h>
+
 #include "port.h"
 #include "addr.h"
+#include "match.h"
+#include "sink.h"
+#include "rlog.h"
+#include "tmpl.h"
+#include "metrics.h"
+#include "rtt.h"
+#include "sim.h"
 
 /* read validator return values */
 #define RVALIDATOR_INCORRECT        -1 /* terminate the connection */
@@ -35,19 +45,72 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define RVALIDATOR_OK               1  /* pass the data to the handler */
 typedef int (*yar_read_validator)(const void *data, size_t len);
 
+/**
+ * Incremental read validators see each input byte once. They are called
+ * with the input that arrived since the last call, one contiguous segment
+ * at a time, and keep their progress in a per-endpoint state which is
+ * zeroed before the first call and after each message passed to on_read.
+ * The input is never made contiguous for validation, so on_read is the
+ * only place where that cost is paid, if at all.
+ */
+struct yar_rvstate {
+    size_t off;             /* offset of data in the input (read-only) */
+    unsigned long state;    /* validator defined */
+    size_t msglen;          /* set on RVALIDATOR_OK if the message ends
+                               before the input does */
+    const void *arg;        /* cli->read_validator_arg (read-only) */
+};
+
+typedef int (*yar_read_validator_inc)(struct yar_rvstate *st, 
+        const void *data, size_t len);
+
+/* ADDRPROTO_UDP endpoints share a few sockets per job. on_established is
+   called as soon as the endpoint is created, each yar_endpoint_write sends
+   one datagram and datagrams received from the endpoint's address and
+   port are passed to on_read. The connect timeout is the time to wait for
+   the first datagram, the read timeout applies after that. Endpoints are
+   counted as established when their first datagram arrives. Datagrams are
+   sent from the event loop, so send errors reach on_error after the
+   yar_endpoint_write that queued them has returned */
 typedef enum {
     ADDRPROTO_TCP,
     ADDRPROTO_UDP
 } yar_addrproto_t;
 
+/* what to do when the input of a connection reaches cli->rbufmax bytes.
+   Reading from the connection is suspended while the input is full. If the
+   read validator has not accepted the input at that point, it is passed to
+   on_read with RBUFPOLICY_TRUNCATE, otherwise on_error is called with 
+   EMSGSIZE and the connection is closed. */
+typedef enum {
+    RBUFPOLICY_PAUSE,       /* wait for the input to be consumed, e.g., by
+                               a handler that consumes it asynchronously */
+    RBUFPOLICY_TRUNCATE,    /* pass incomplete input to on_read */
+    RBUFPOLICY_TERMINATE    /* close if on_read leaves the input full */
+} yar_rbufpolicy_t;
+
 typedef struct yar_endpoint_handle yar_endpoint_handle_t;
 
+/* lifecycle timestamps of an endpoint, in microseconds on the monotonic 
+   clock. Events that have not happened are zero */
+struct yar_endpoint_times {
+    uint64_t dispatch;      /* connection attempt, or reuse */
+    uint64_t connect;       /* established, or first datagram received */
+    uint64_t first_read;    /* first input */
+    uint64_t last_read;     /* latest input */
+    uint64_t close;         /* error, timeout or EOF, set before the 
+                               handler is called */
+};
+typedef struct yar_payload yar_payload_t;
+
 typedef void (*yar_cleanup_func)(void *data);
 
-/* TICKER_* - yar_ticker_func return values */
+/* TICKER_* - yar_ticker_func return values. missed is the number of 
+   ticks that were due since the previous call but not fired, because the
+   event loop was busy */
 #define TICKER_DONE 0
 #define TICKER_CONT 1
-typedef int (*yar_ticker_func)(void *data);
+typedef int (*yar_ticker_func)(void *data, unsigned long missed);
 
 struct yar_endpoint {
     yar_endpoint_handle_t *handle;
@@ -57,14 +120,80 @@ struct yar_endpoint {
 
 typedef void (*yar_endpoint_handler)(struct yar_endpoint *ep);
 
+/* yar_client flags */
+#define CLIENT_FLG_PIPELINE     1 /* write queued requests without waiting
+                                     for the previous response */
+#define CLIENT_FLG_PARTIAL_CONSUME 2 /* only drain input consumed by on_read,
+                                        see yar_endpoint_consume */
+#define CLIENT_FLG_SHUTDOWN_WR  4 /* half-close connections once their output
+                                     has been written and no requests are
+                                     queued. Later writes fail with EPIPE */
+
+/* how a job ended, see struct yar_job_summary */
+#define JOB_DONE        0 /* every target was dispatched and closed */
+#define JOB_STOPPED     1 /* stopped by yar_job_stop */
+#define JOB_DEADLINE    2 /* stopped when cli->jto ran out */
+
+struct yar_job_summary {
+    unsigned int status;
+    uint64_t elapsed_us;
+    uint64_t dispatched;    /* connection attempts, including failed ones */
+    uint64_t established;
+    uint64_t refused;       /* included in errors */
+    uint64_t timedout;
+    uint64_t eof;
+    uint64_t errors;
+    uint64_t cancelled;     /* closed when the grace period ran out, with
+                               ECANCELED. Included in errors */
+
+    /* the first target that was not dispatched, if resumable is set */
+    int resumable;
+    yar_addr_t resume_addr;
+    yar_port_t resume_port;
+};
+
 struct yar_client {
     yar_addrproto_t proto;
+    unsigned int flags;
 
     /* behavioral settings */
     unsigned int tr;    /* tick rate (ticks / second) */
     unsigned int cpt;   /* connect(2) calls per tick */
     unsigned int ncc;   /* number of concurrent connections */
     unsigned int to;    /* I/O timeout in microseconds */
+    unsigned int weight; /* share of the global limits, see yar_set_limits.
+                            0 is the same as 1 */
+
+    /* per-phase timeouts in microseconds. A value of zero for cto, rto or
+       wto means that 'to' is used for that phase. tto is an absolute
+       deadline measured from the connection attempt, zero disables it */
+    unsigned int cto;   /* connect timeout */
+    unsigned int rto;   /* idle read timeout (established connections) */
+    unsigned int wto;   /* write timeout (established connections) */
+    unsigned int tto;   /* total per-connection deadline */
+
+    /* job deadline in seconds from yar_connect, zero disables it. When it 
+       runs out, the job is stopped like with yar_job_stop */
+    unsigned int jto;
+
+    /* microseconds open endpoints get to finish after the job is stopped,
+       before they are closed. Zero closes them on the next tick */
+    unsigned int grace;
+
+    /* ADDRPROTO_UDP: number of shared sockets per address family, 
+       0 for the default */
+    unsigned int nudp;
+
+    /* maximum number of idle connections kept for reuse by 
+       yar_endpoint_release, 0 disables reuse */
+    unsigned int npool;
+
+    /* per-connection buffer limits in bytes, 0 for no limit. Writes that
+       would grow the output buffer past wbufmax fail. Datagrams that do 
+       not fit in the input are truncated */
+    size_t rbufmax;
+    size_t wbufmax;
+    yar_rbufpolicy_t rbufpolicy;
 
     /* event callbacks */
     yar_endpoint_handler on_established;
@@ -73,25 +202,259 @@ struct yar_client {
     yar_endpoint_handler on_timeout;
     yar_endpoint_handler on_error;
 
-    /* read buffer message validator */
+    /* called when the output of a connection has been written to the 
+       socket. Not called for ADDRPROTO_UDP */
+    yar_endpoint_handler on_write_drained;
+
+    /* read buffer message validator. read_validator_inc is used instead
+       of read_validator if set. See validators.h for common framings */
     yar_read_validator read_validator;
+    yar_read_validator_inc read_validator_inc;
+    const void *read_validator_arg;
+
+    /* compiled matcher to run over all input as it arrives, before it is 
+       validated. See yar_endpoint_matches */
+    const yar_matcher_t *matcher;
+
+    /* if set, no connections are dispatched while the sink is congested */
+    yar_sink_t *sink;
+
+    /* if set, a record is appended for each connection, message, error,
+       timeout and EOF. Messages are logged before on_read is called */
+    yar_rlog_t *rlog;
+
+    /* if set, the job's metrics are added here as well as to the global 
+       ones. It should be zeroed before the job is started */
+    struct yar_metrics *metrics;
+
+    /* if set, connect times are sampled into the estimator, and the 
+       connect timeout of each new endpoint is derived from the estimate 
+       for its prefix. The configured connect timeout is used as an upper 
+       bound, and for prefixes without an estimate, and an eighth of it as
+       a lower bound. It can be shared by jobs */
+    yar_rtt_t *rtt;
+
+    /* if set, filled in when the job is done */
+    struct yar_job_summary *summary;
 };
 
 void yar_endpoint_set_cdata(yar_endpoint_handle_t *eph, void *cdata,
         yar_cleanup_func free_cb);
 void *yar_endpoint_get_cdata(yar_endpoint_handle_t *eph);
 void *yar_endpoint_read(yar_endpoint_handle_t *eph, size_t *len);
-void yar_endpoint_write(yar_endpoint_handle_t *eph, const void *data,
+int yar_endpoint_write(yar_endpoint_handle_t *eph, const void *data,
         size_t len);
+
+/**
+ * yar_endpoint_writev --
+ *     like yar_endpoint_write, for data in niov buffers. The buffers are 
+ *     copied into the output in one piece, or sent as one datagram
+ */
+int yar_endpoint_writev(yar_endpoint_handle_t *eph, const struct iovec *iov,
+        int niov);
+
+/**
+ * yar_payload_new --
+ *     copy data into an immutable, reference counted payload, which can be
+ *     written to any number of endpoints without being copied again. The
+ *     caller holds the first reference
+ */
+yar_payload_t *yar_payload_new(const void *data, size_t len);
+yar_payload_t *yar_payload_ref(yar_payload_t *p);
+void yar_payload_unref(yar_payload_t *p);
+
+/**
+ * yar_endpoint_write_payload --
+ *     like yar_endpoint_write, but the output buffer of the endpoint 
+ *     refers to the payload instead of holding a copy. The reference is
+ *     dropped once the payload has been written or the endpoint closed, 
+ *     so the caller may unref it right away
+ */
+int yar_endpoint_write_payload(yar_endpoint_handle_t *eph, yar_payload_t *p);
+
+/**
+ * yar_endpoint_write_tmpl --
+ *     render a template for the endpoint's address and port, directly into
+ *     its output buffer. wbufmax is checked against the longest rendering
+ *     of the template
+ */
+int yar_endpoint_write_tmpl(yar_endpoint_handle_t *eph, const yar_tmpl_t *t);
+
+/**
+ * yar_endpoint_peek --
+ *     zero-copy alternative to yar_endpoint_read. Fills in at most niov
+ *     iovecs with the segments of the input buffer, in order, and returns
+ *     the number of segments needed to cover all of it, which may be more
+ *     than niov. The iovecs are valid until the input is consumed or the
+ *     handler returns.
+ */
+int yar_endpoint_peek(yar_endpoint_handle_t *eph, struct iovec *iov, 
+        int niov);
+
+/**
+ * yar_endpoint_consume --
+ *     remove the first n bytes from the input buffer. Bytes consumed in 
+ *     on_read are not drained again when on_read returns.
+ *
+ *     With CLIENT_FLG_PARTIAL_CONSUME, on_read drains nothing but what the
+ *     handler consumes. If input remains after the handler consumed some,
+ *     the rest is validated and passed to on_read again, so a handler can
+ *     take one message at a time without copying leftovers. If the handler
+ *     consumes nothing, it is called again when more input arrives.
+ */
+void yar_endpoint_consume(yar_endpoint_handle_t *eph, size_t n);
+
+/**
+ * yar_endpoint_msglen --
+ *     length of the message passed to on_read, as reported by an
+ *     incremental read validator, or the length of the input if unknown
+ */
+size_t yar_endpoint_msglen(yar_endpoint_handle_t *eph);
+
+/**
+ * yar_endpoint_get_times --
+ *     lifecycle timestamps of an endpoint. Valid until the endpoint is 
+ *     closed. Input is timestamped when it is processed, which needs an 
+ *     on_read handler
+ *
+ * @return NULL if eph is NULL, i.e., the endpoint was never dispatched
+ */
+const struct yar_endpoint_times *yar_endpoint_get_times(
+        yar_endpoint_handle_t *eph);
+
+/**
+ * yar_endpoint_matches --
+ *     IDs of the cli->matcher patterns found in the input of an endpoint 
+ *     so far, each reported once, in the order they were first found. All
+ *     input received when on_read is called has been scanned. The array is
+ *     valid until the handler returns
+ *
+ * @return the number of IDs
+ */
+size_t yar_endpoint_matches(yar_endpoint_handle_t *eph, 
+        const unsigned int **ids);
 const char *yar_endpoint_get_errmsg(yar_endpoint_handle_t *eph);
 void yar_endpoint_terminate(struct yar_endpoint *ep);
 
+/**
+ * yar_endpoint_enqueue --
+ *     queue a request on an endpoint. Requests are written one at a time;
+ *     the next one is written when the response to the previous one has
+ *     been passed to on_read, so a read validator should be used to frame
+ *     responses. With CLIENT_FLG_PIPELINE, requests are written at once.
+ *     Combine it with CLIENT_FLG_PARTIAL_CONSUME so that responses which
+ *     arrive together are passed to on_read, and counted, one at a time.
+ *
+ * @return -1 on error, 0 on success
+ */
+int yar_endpoint_enqueue(yar_endpoint_handle_t *eph, const void *data,
+        size_t len);
+int yar_endpoint_enqueue_payload(yar_endpoint_handle_t *eph, 
+        yar_payload_t *p);
+
+/**
+ * yar_endpoint_pending --
+ *     number of requests that are queued or waiting for a response
+ */
+unsigned int yar_endpoint_pending(yar_endpoint_handle_t *eph);
+
+/**
+ * yar_endpoint_release --
+ *     like yar_endpoint_terminate, but an established idle connection is
+ *     kept open (up to cli->npool connections) and reused by the next 
+ *     connection to the same address and port, in this or another job.
+ *     Connections with pending requests or unread data are closed
+ */
+void yar_endpoint_release(struct yar_endpoint *ep);
+
 int yar_connect(struct yar_client *cli, const char *addrspec, 
         const char *portspec);
 
+/**
+ * yar_set_limits --
+ *     limit the number of concurrent connections and the number of 
+ *     connection attempts per second of all jobs together, 0 for no limit.
+ *     The budgets are divided among jobs with connections left to dispatch
+ *     in proportion to cli->weight, on top of the limits of each job. Only
+ *     jobs started after the call are scheduled this way
+ */
+void yar_set_limits(unsigned int ncc, unsigned int cps);
+
+/**
+ * yar_get_metrics --
+ *     copy the metrics of all jobs. The live counter is the number of 
+ *     endpoints open right now
+ */
+void yar_get_metrics(struct yar_metrics *m);
+
+/**
+ * yar_set_sim --
+ *     connect TCP jobs to a simulated network instead of sockets, and run
+ *     yar_main, tickers and timeouts on its virtual clock. Set it before
+ *     any job or ticker is started, NULL to go back to sockets. UDP jobs 
+ *     cannot be simulated. on_write_drained is not called for simulated 
+ *     endpoints, and they are not kept for reuse
+ *
+ * @return -1 with errno set to EBUSY if jobs are running, 0 on success
+ */
+int yar_set_sim(yar_sim_t *sim);
+
+/**
+ * yar_job_stop --
+ *     stop the jobs of a client. No more connections are dispatched, and 
+ *     open endpoints are closed with ECANCELED once cli->grace has passed.
+ *     The job is done when the last one is closed, see cli->summary
+ *
+ * @return -1 with errno set to ESRCH if the client has no running job, 
+ *         0 on success
+ */
+int yar_job_stop(struct yar_client *cli);
+
+/**
+ * yar_set_profiling --
+ *     count the calls of every handler and ticker, and time one in every 
+ *     rate of them, 0 disables profiling. Timed calls that take at least 
+ *     slow_us microseconds are logged to sink with their endpoint, if 
+ *     sink is set and slow_us is non-zero. The lag of tickers behind their 
+ *     deadlines is recorded on every tick while enabled. See 
+ *     struct yar_profile
+ */
+void yar_set_profiling(unsigned int rate, unsigned int slow_us,
+        yar_sink_t *sink);
+
+/* copy the callback profile */
+void yar_get_profile(struct yar_profile *p);
+
+/**
+ * yar_export_metrics --
+ *     print the metrics of all jobs to a sink every interval seconds, and 
+ *     once more when the last job is done. See yar_metrics_print. The
+ *     callback profile is printed as well while profiling
+ *
+ * @return -1 on error, 0 on success
+ */
+int yar_export_metrics(yar_sink_t *sink, unsigned int interval);
+
+/**
+ * yar_ticker --
+ *     call func tick_rate times per second, on fixed deadlines on the 
+ *     monotonic clock, until it returns TICKER_DONE. Rates up to 
+ *     1000000000 ticks per second are accepted, but ticks that come faster
+ *     than the event loop turns are reported as missed
+ */
 int yar_ticker(yar_ticker_func func, unsigned int tick_rate, void *data, 
         yar_cleanup_func free_cb);
 
+/**
+ * yar_set_membudget --
+ *     limit the total number of bytes buffered by all connections. When 
+ *     the limit is exceeded, no new connections are dispatched until enough
+ *     buffered data has been consumed or sent. 0 disables the limit. Only
+ *     connections dispatched after the call are accounted for.
+ */
+void yar_set_membudget(size_t bytes);
+size_t yar_get_membuffered();
+
 int yar_main();
 
 #endif